@@ -6,17 +6,22 @@
  *
  * created by codingABI https://github.com/codingABI/Falkenstein3D 
  *
- * This project uses two different raycaster engines, which can be select by pressing Key "3":
+ * This project uses three different raycaster engines, which can be select by pressing Key "3":
  * - Degree based raycaster by codingABI, inspired by https://github.com/3DSage/OpenGL-Raycaster_v1 and https://github.com/3DSage/OpenGL-Raycaster_v2
  * - DDA Raycaster by Lode Vandevenne (see license details below), faster and used by default
+ * - DDA Raycaster with 16.16 fixed point integers instead of floating point (for cpus with slow floating point)
  *
  * Keyboard control:
  * s/S - Change pixel size (impacts performance)
  * 1   - on/off for textures for floor and roof
  * 2   - on/off for floor, roof, sky and ground
- * 3   - change raycaster engine (old from codingABI <-> DDA from Lode Vandevenne) 
+ * 3   - change raycaster engine (DDA from Lode Vandevenne -> old from codingABI -> fixed point DDA)
  * 4   - on/off for round pixels
- * 5   - on/off for automatically set pixel size dependent on framerate
+ * 5   - on/off for automatically set pixel size dependent on frame time
+ * 6   - on/off for CPU framebuffer (off = draw every pixel as OpenGL point)
+ * 7   - on/off for mipmaps (smaller textures for distant walls, floor and roof)
+ * 8   - on/off for frame timing overlay (min/avg/p99 per render stage)
+ * 9   - on/off for frame reuse (draw only changed columns while the view is unchanged)
  * t/T - on/off for all textures
  * f/F - on/off for fullscreen mode
  * ESC,q,Q - exit program
@@ -32,6 +37,13 @@
  * middle mouse button     - move player forward
  * scroll button backward  - move player backward
  *
+ * Command line (see --help):
+ * --headless renders frames without window and OpenGL and reports the timing
+ * --record/--replay saves input events to a file and plays them back (same level and start options needed)
+ * --benchmark renders fixed camera paths with all engines and settings, writes frame time percentiles as JSON and compares them with --baseline
+ * --reference/--verify writes reference images of fixed poses with frozen clock and compares later renderings with them
+ * --texturepack loads textures from a texture pack file (--savetextures writes the built-in textures as one)
+ *
  * History:
  * 16.06.2022, Initial version
  * 29.06.2022, Add more comments
@@ -39,6 +51,31 @@
  * 01.07.2022, Add joystick and mouse support
  * 01.07.2022, First upload to github
  * 14.10.2022, Replace strncpy by snprintf
+ * 17.10.2026, Add CPU framebuffer for 3d view
+ * 17.10.2026, Add command line options and headless render mode
+ * 17.10.2026, Add multithreaded frame job system
+ * 17.10.2026, Add SSE2/AVX2 packet ray traversal for DDA raycaster
+ * 17.10.2026, Add fixed point floor and roof kernel (AVX2) for CPU framebuffer
+ * 17.10.2026, Add light tables for distance shading
+ * 17.10.2026, Sample walls and sprites from column-major 32 bit textures
+ * 17.10.2026, Add mipmaps for distant walls, floor and roof
+ * 17.10.2026, Resolve animated texel colors once per frame
+ * 17.10.2026, Draw sprites by run-length encoded opaque spans
+ * 17.10.2026, Sprites in growable list with grid culling and radix sort
+ * 17.10.2026, Load levels from memory-mapped binary map files with any map size
+ * 17.10.2026, Bit-packed solid cell bitmap with sentinel border for ray hit tests
+ * 17.10.2026, Hierarchical empty space skipping (8x8 tiles, 64x64 blocks) for DDA rays
+ * 17.10.2026, Old raycaster with ray angle tables and one traversal until the nearest wall
+ * 17.10.2026, Third raycaster engine: DDA in 16.16 fixed point with reciprocal table
+ * 17.10.2026, Frame scheduler with frame rate cap, vsync and idle mode instead of busy loop
+ * 17.10.2026, Automatic pixel size by frame time budget with fractional sizes and filtered upscaling
+ * 17.10.2026, Per stage frame timing overlay and CSV export
+ * 17.10.2026, Input events in lock-free ring, handled in fixed simulation ticks, with record and replay
+ * 17.10.2026, Camera path benchmark with JSON report and baseline comparison
+ * 17.10.2026, Reference image harness with frozen clock, per pixel tolerance and diff images
+ * 17.10.2026, Texture packs from memory-mapped files with any texture size and count, optional reload on changes
+ * 17.10.2026, DDA raycasters cast wall rays before the background, floor and roof casting skips pixels behind walls
+ * 17.10.2026, Frame reuse: with unchanged view only columns with sky rotation or animated texels are drawn again
  *
  * ----------------------------------------------------------------
  * License details:
@@ -63,7 +100,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  *
  * ================================================================
- * DDA raycaster functions (drawRaycastDDA, drawBackground, sortSprites, drawSprites)
+ * DDA raycaster functions (drawRaycastDDA, drawRaycastFixed, drawBackground, sortSprites, drawSprites)
  * ================================================================
  * Copyright (c) 2004-2021, Lode Vandevenne
  * All rights reserved.
@@ -130,24 +167,48 @@
 
 #include <iostream>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
 #include <vector>
 #include <algorithm>
+#include <climits>
 #include <GL/freeglut.h>
+#ifndef _WIN32
+#include <GL/glx.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
 #include <math.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMDX86 // SSE2/AVX2 kernels, selected at runtime
+#include <immintrin.h>
+#endif
+
+#define g_textures g_builtinTextures // built-in textures, g_textures points to them or into a texture pack
 #ifdef FREETEXTURES 
 #include "./textures_free.h" //Only CC0 or CC-BY-SA 3.0-Textures
 #else
 #include "./textures.h"
 #endif
+#undef g_textures
 
-#define GRIDSIZE 32 // size of wall height or width
-#define MAPWIDTH 16 // width of map
-#define MAPHEIGHT 16 // height of map
+#define GRIDSIZE 32 // maximal size of map cell in 2d view
+#define MAP2DSIZE 512 // maximal width and height of 2d map
+#define MINGRIDSIZE 4 // minimal size of map cell in 2d view (no 2d map for larger maps)
 #define STRIPEHEIGHT 32 // height of wall
 #define VIEWERBOXSIZE 6 // size of viewer in 2d view
 #define SKYSCALE 5 // pixel size of sky texture
 #define MAXWIDTH 4096// maximal 3d view width (because of zbuffer)
+#define MAXHEIGHT 4096 // maximal 3d view height (row distance of floor coordinates in 16.16 fixed point)
 
 #define PREVEREDVIEWANGLE 40 // viewer angle if viewport is 1:1
 #define MINVIEWPORT3DWIDTH 200 // minimal width of 3d view
@@ -155,16 +216,17 @@
 #define SIDELEFTRIGHT 1
 #define SIDEUPDOWN 2	
 #define HUGEBIGNUMBER 100000
+#define NOCROSSING (2*HUGEBIGNUMBER) // distance of finished crossings in old raycaster engine
 #define STEPSIZE 0.03125f // distance when moving viewer one step forward or backward
  
 // abs with support for floats
 #define myAbs(x) ((x)>0?(x):-(x))
 
-// initial viewer settings
+// initial viewer settings of built-in level
 #define DEFAULTVIEWERX 4
 #define DEFAULTVIEWERY 13
 #define DEFAULTVIEWERANGLE 103
-// Position to finish the game
+// Position to finish the game in built-in level
 #define FINISHX 15
 #define FINISHY 1
 
@@ -172,9 +234,85 @@
 float g_viewerX;
 float g_viewerY;
 float g_viewerAngle;
+// Viewer position, angle at game start (from level or command line)
+float g_startViewerX = DEFAULTVIEWERX;
+float g_startViewerY = DEFAULTVIEWERY;
+float g_startViewerAngle = DEFAULTVIEWERANGLE;
+float g_argViewerX = NAN, g_argViewerY = NAN, g_argViewerAngle = NAN; // start position, angle from command line (NAN = from level)
+// Cell to finish the game
+int g_finishX = FINISHX;
+int g_finishY = FINISHY;
 
 int g_fps=0; // current frames per second
 
+// Frame pacing
+#define IDLEFRAMEINTERVAL 250 // maximal ms between frames in idle mode (texts, timeouts)
+#define SKYROTATEINTERVAL 100 // ms per sky texture pixel step
+#define ANIMATEDTEXELINTERVAL 10 // ms per color step of animated texels
+#define AUTOROTATESTEP 0.08f // degrees of viewer rotation per simulation tick on start screen
+int g_targetFps = 0; // frame rate cap (0 = no cap)
+bool g_vsync = false; // wait for vertical retrace on buffer swap
+bool g_idleThrottling = true; // without input redraw only when the image changes (sky, animated texels, texts)
+int g_lastFrameTime = 0; // start time of last frame
+double g_nextFrameTime = 0; // earliest start of next frame by frame rate cap (ms, fractional for exact rates like 144 fps)
+
+// Dynamic resolution (automatic pixel size)
+#define MAXPIXELSIZE 16
+#define PIXELSIZESTEP 0.125f // fractional pixel sizes in steps of 1/8
+double g_frameTimeBudget = 10; // ms per frame the automatic pixel size aims for
+double g_smoothedFrameTime = 0; // moving average of frame time for automatic pixel size (0 = no frame yet)
+int g_nextImageChangeTime = INT_MAX; // earliest time the current image gets outdated without input
+int g_scheduledFrameTime = -1; // time of next frame timer (-1 = none)
+int g_frameTimerGeneration = 0; // only the latest frame timer triggers a frame
+std::atomic<bool> g_animatedTexelsDrawn(false); // animated texels visible in current frame
+
+// Input events: GLUT callbacks push them into a lock-free single producer/single consumer ring,
+// simulation ticks with fixed length drain it. So a recorded event stream replays identically at any frame rate.
+#define SIMULATIONTICK 20 // ms per simulation tick (input, viewer movement, game state)
+#define INPUTRINGSIZE 256 // events (power of 2)
+#define INPUTKEY 0 // key pressed (code = key)
+#define INPUTSPECIALDOWN 1 // special key pressed (code = glut key)
+#define INPUTSPECIALUP 2 // special key released (code = glut key)
+#define INPUTJOYSTICK 3 // joystick changed (code = buttons, x/y = axes)
+#define INPUTMOUSE 4 // mouse button (code = button, x = state)
+#define INPUTWHEEL 5 // mouse wheel (x = direction)
+struct InputEvent {
+	int tick; // simulation tick which handles the event
+	int type;
+	int code;
+	int x;
+	int y;
+};
+InputEvent g_inputRing[INPUTRINGSIZE];
+std::atomic<unsigned int> g_inputRingHead(0); // next event to read (only changed by consumer)
+std::atomic<unsigned int> g_inputRingTail(0); // next free slot (only changed by producer)
+int g_simulationTick = 0; // next simulation tick
+int g_simulationTime = 0; // time of current simulation tick (game state times are based on it)
+const char *g_recordFileName = NULL; // write handled input events to this file
+FILE *g_recordFile = NULL;
+const char *g_replayFileName = NULL; // play back input events from this file
+std::vector<InputEvent> g_replayEvents;
+size_t g_replayPosition = 0; // next event to replay
+
+// Frame timing per render stage
+#define STAGEBACKGROUND 0 // floor, roof, sky and ground
+#define STAGEWALLS 1 // raycaster (old engine draws sky too)
+#define STAGESPRITES 2
+#define STAGEPRESENT 3 // CPU framebuffer to OpenGL
+#define STAGEMAP 4 // 2d map and viewer
+#define STAGEHUD 5 // infos, messages and timing overlay
+#define STAGESWAP 6 // buffer swap (includes waiting for the driver)
+#define STAGECOUNT 7
+#define TIMINGHISTORY 128 // frames for rolling min/avg/p99
+const char *g_stageNames[STAGECOUNT] = { "background", "walls", "sprites", "present", "map", "hud", "swap" };
+double g_stageTimes[STAGECOUNT]; // ms per stage in current frame
+float g_stageHistory[STAGECOUNT+1][TIMINGHISTORY]; // ms per stage of last frames (last row = whole frame)
+int g_timedFrames = 0; // frames stored in history so far
+std::chrono::steady_clock::time_point g_stageStartTime; // begin of current stage
+bool g_showTimings = false; // timing overlay visible
+const char *g_timingFileName = NULL; // write stage times of every frame to this CSV file
+FILE *g_timingFile = NULL;
+
 // Status for pressed cursor keys
 bool g_buttonUpPressed = false;
 bool g_buttonDownPressed = false;
@@ -201,18 +339,63 @@ int g_viewPort3dHalfHeight; // half of 3d-height (to improve speed)
 int g_viewPort3dPhysicalWidth; // real width of 3d viewport
 int g_viewPort3dPhysicalHeight; // real height of 3d viewport
 int g_viewPort3dOffsetX; // begin of real 3d viewport
-int g_pixelSize=2; // size of display pixel
+float g_pixelSize=1; // size of display pixel (fractional sizes only with CPU framebuffer)
 int g_pixelOffset; // x/y-offset for pixel
 int g_lineOffset; // x-offset for line 
 float g_textureSkyGroundStepX; // texture pixel stepsize in sky and ground texture per display pixel step  
+int g_textureSkyGroundOffsetAutoRotate; // texture pixel offset for sky in current frame
+int g_textureSkyGroundOffsetStatic; // texture pixel offset for ground in current frame
 
 bool g_fullScreenMode = true; // Fullscreen mode active? (No 2D map)
 bool g_showTextures = true; // Textures enabled?
 bool g_showBackgroundTexture = true; // Texture for sky enabled?
 bool g_showBackground = true; // Floor and roof enabled?
-bool g_oldStyle = false; // use old raycaster
+// raycaster engines
+#define ENGINEDDA 0
+#define ENGINEOLD 1
+#define ENGINEFIXED 2
+#define ENGINECOUNT 3
+const char *g_engineNames[ENGINECOUNT] = { "dda", "old", "fixed" };
+int g_engine = ENGINEDDA; // current raycaster engine
 bool g_roundPixels = false; // round pixels?
-bool g_autoPixelSize = true; // set pixel size automatically dependent on framerate
+bool g_autoPixelSize = true; // set pixel size automatically dependent on frame time
+bool g_useFrameBuffer = true; // render 3d view into CPU framebuffer (false = draw every pixel as OpenGL point)
+// Headless render mode (no window, no OpenGL, see command line options)
+bool g_headless = false;
+int g_headlessFrames = 100; // frames to render in headless mode
+int g_headlessWidth = 1280; // 3d view width in headless mode
+int g_headlessHeight = 720; // 3d view height in headless mode
+int g_threadCount = 0; // threads for rendering into CPU framebuffer (0 = one per cpu core)
+const char *g_saveMapFileName = NULL; // write level to this map file and exit
+const char *g_saveTexturesFileName = NULL; // write built-in textures to this texture pack file and exit
+// Benchmark (headless, camera paths with all engines and settings)
+#define BENCHMARKPATHSTART 0 // full rotation at start position
+#define BENCHMARKPATHFINISH 1 // full rotation at finish cell (corridor to the exit in built-in level)
+#define BENCHMARKPATHSPRITES 2 // look at every sprite from a free spot nearby
+#define BENCHMARKPATHWALK 3 // walk from start position in start direction until a wall
+#define BENCHMARKPATHCOUNT 4
+#define BENCHMARKROTATIONSTEP 4 // degrees per frame when rotating
+#define BENCHMARKWALKFRAMES 90 // maximal frames of walk path
+#define BENCHMARKWARMUPFRAMES 3 // untimed frames before every run
+#define BENCHMARKREPEATS 3 // passes over all runs, the median time per frame counts (filters other load on the machine)
+#define BENCHMARKMINDIFF 0.05 // ms, smaller differences to baseline are noise
+#define BENCHMARKKEYLENGTH 160
+const char *g_benchmarkPathNames[BENCHMARKPATHCOUNT] = { "start", "finish", "sprites", "walk" };
+const char *g_benchmarkFileName = NULL; // run benchmark and write results as JSON to this file
+const char *g_baselineFileName = NULL; // compare benchmark with results in this JSON file
+double g_benchmarkTolerance = 10; // % slower than baseline which counts as regression
+// Reference images (headless, poses of benchmark camera paths with frozen clock)
+#define REFERENCEWIDTH 320
+#define REFERENCEHEIGHT 200
+#define REFERENCEPOSESTEP 15 // every 15th frame of the benchmark camera paths
+#define REFERENCECLOCK 0 // ms, frozen time for sky rotation and animated texels
+const char *g_referenceDirectory = NULL; // write reference images into this directory
+const char *g_verifyDirectory = NULL; // compare rendered images with reference images in this directory
+int g_pixelTolerance = 0; // maximal difference per color channel to reference image
+int g_frozenTime = -1; // getElapsedTime returns always this time (-1 = real clock)
+bool g_useMipmaps = true; // smaller textures for distant walls, floor and roof in CPU framebuffer
+bool g_reuseFrames = true; // render only changed columns of CPU framebuffer while the view does not change
+bool g_reuseFramesOption = false; // --framereuse given (headless mode renders complete frames by default)
 // Temporary stored previous window dimensions, when using fullscreen mode
 int g_savedWindowWidth;
 int g_savedWindowHeight;
@@ -241,14 +424,140 @@ double g_cachedCos, g_cachedSin, g_cachedCos90, g_cachedSin90;
 
 //1D Zbuffer for sprite handling
 double g_zBuffer[MAXWIDTH];
+// Ray angle of screen columns relative to viewer angle for old raycaster engine (rebuilt by prepareRayAngleTables on resize or view angle change)
+double g_rayAngleCos[MAXWIDTH]; // also used for fisheye fix
+double g_rayAngleSin[MAXWIDTH];
+
+// Result of DDA ray for one screen column
+struct RayHit {
+	double rayDirX, rayDirY; // ray direction
+	double perpWallDist; // perpendicular distance to wall
+	int mapX, mapY; // map box of wall
+	int side; // 0 = x-side, 1 = y-side
+	bool offMap; // ray left map without hitting a wall
+};
+#define RAYPACKETCOLUMNS 64 // columns cast at once by DDA ray kernel
+
+// 16.16 fixed point values for fixed point DDA raycaster
+#define FIXEDSHIFT 16
+#define FIXEDONE (1 << FIXEDSHIFT)
+#define FIXEDFAR 0x80000000u // distance limit of fixed point rays (32768, walls further away are smaller than 2 pixels)
+#define RECIPROCALBITS 10 // reciprocal table size 2^RECIPROCALBITS (+1 for interpolation)
+unsigned int g_reciprocalTable[(1 << RECIPROCALBITS)+1]; // 2^31/(1+i/2^RECIPROCALBITS)
+int g_cameraXFixed[MAXWIDTH]; // x-coordinate in camera space (-1..1) of screen columns (rebuilt on resize)
+int g_dirXFixed, g_dirYFixed, g_planeXFixed, g_planeYFixed; // direction vector and camera plane
+// Result of fixed point DDA ray for one screen column
+struct RayHitFixed {
+	int rayDirX, rayDirY; // ray direction
+	unsigned int perpWallDist; // perpendicular distance to wall
+	int mapX, mapY; // map box of wall
+	int side; // 0 = x-side, 1 = y-side
+	bool offMap; // ray left map or got further than FIXEDFAR without hitting a wall
+};
+// Wall rays of current frame (DDA raycasters cast them before the background, so floor and roof casting skips pixels behind walls)
+RayHit g_wallHits[MAXWIDTH]; // ray of every screen column (DDA raycaster)
+RayHitFixed g_wallHitsFixed[MAXWIDTH]; // ray of every screen column (fixed point DDA raycaster)
+int g_wallCover[MAXWIDTH]; // background rows (counted from horizon) hidden by an opaque wall in every screen column
+int g_minWallCover, g_maxWallCover; // background rows below g_minWallCover are hidden completely, rows from g_maxWallCover on are visible completely
+
+// Frame reuse: while the view does not change, only columns with changed pixels (sky rotation, animated texels) are rendered again.
+// Columns are rendered completely (background, walls, sprites), so they are identical to a complete frame.
+struct FrameKey {
+	float viewerX, viewerY, viewerAngle;
+	int width, height;
+	float pixelSize;
+	int engine;
+	bool showTextures, showBackgroundTexture, showBackground, useMipmaps, useFrameBuffer;
+	int sceneChanges;
+};
+FrameKey g_lastFrameKey; // view of last complete frame
+bool g_lastFrameValid = false;
+bool g_frameReused = false; // current frame reuses last frame
+int g_sceneChanges = 0; // changes of level or textures (invalidate the last frame)
+std::vector<unsigned int> g_lastAnimatedTexels; // colors of special texels in last frame
+int g_lastSkyOffset; // sky rotation in last frame
+unsigned char g_changedColumns[MAXWIDTH]; // columns rendered in current frame
+int g_changedBeginX, g_changedEndX; // range of columns rendered in current frame (for upload)
+unsigned char g_animatedColumns[MAXWIDTH]; // columns showing animated texels (set by wall and sprite columns)
+unsigned char g_skyColumns[MAXWIDTH]; // columns showing sky (found at first sky rotation after a complete frame)
+bool g_skyColumnsValid = false;
+void (*g_castRaysDDA)(int beginX, int endX, RayHit *hits); // current DDA ray kernel
+const char *g_kernelName; // name of current SIMD kernels
+// DDA ray kernel selection (--simd option)
+#define SIMDAUTO 0
+#define SIMDOFF 1
+#define SIMDSSE2 2
+#define SIMDAVX2 3
+int g_simdMode = SIMDAUTO;
+
+// Fixed point row of floor, roof, sky and ground for CPU framebuffer
+struct BackgroundRow {
+	int floorX, floorY; // 16.16 map position of leftmost column
+	int stepX, stepY; // 16.16 map step per column
+	unsigned int shade; // brightness 0-256 for row (distance shading)
+	int groundTexel, skyTexel; // first texel of ground and sky texture row
+	unsigned int skyGroundStep; // 16.16 sky and ground texture step per column
+	int mipLevel; // mipmap level for floor and roof textures
+	unsigned int *floorLine, *roofLine; // framebuffer rows below and above horizon
+};
+void (*g_drawBackgroundSpan)(const BackgroundRow &row, int beginX, int endX); // current background kernel (full textures)
+
+// CPU framebuffer for 3d view (one pixel per viewport pixel, uploaded once per frame)
+std::vector<unsigned int> g_frameBuffer;
+// pack color for framebuffer (byte order R,G,B,A in memory on little endian systems, as needed by GL_RGBA/GL_UNSIGNED_BYTE)
+#define RGBA(r,g,b) ((unsigned int)(r) | ((unsigned int)(g) << 8) | ((unsigned int)(b) << 16) | 0xff000000)
+// darken packed color by brightness shade 0-256 (red/blue and green/alpha multiplied pairwise)
+#define SHADERGBA(color,shade) (((((color) & 0x00ff00ff) * (shade) >> 8) & 0x00ff00ff) | ((((color) >> 8) & 0x00ff00ff) * (shade) & 0xff00ff00) | 0xff000000)
+
+// Light tables (colormap): color channel value for every brightness level, replaces the divisions per pixel
+#define LIGHTLEVELS 64
+#define FULLLIGHT (LIGHTLEVELS-1)
+unsigned char g_lightTable[LIGHTLEVELS][256];
+
+// Current textures (built-in textures or textures of memory-mapped texture pack)
+int g_textureSize = TEXTURESIZE; // width and height of every texture (power of 2)
+int g_textureCount = (int) (sizeof(g_builtinTextures)/sizeof(g_builtinTextures[0]));
+std::vector<const unsigned char *> g_textures; // RGB texels of every texture (row by row)
+// Textures with a fixed role (numbered like the built-in textures), a texture pack needs at least these
+const int g_roleTextures[] = { TEXTURECANDLE, TEXTURECOLORLINE, TEXTUREGROUND, TEXTURESKY, TEXTURELOGO,
+	TEXTUREWALLOPENER01, TEXTUREWALLOPENER02, TEXTUREWALLOPENER03, TEXTUREROUGHWALL };
+
+// Textures as packed colors (all textures in one block per mipmap level, level n has size g_textureSize>>n)
+#define MAXMIPLEVELS 16
+std::vector<unsigned int> g_texturesRGBA[MAXMIPLEVELS]; // row-major for floor and roof
+std::vector<unsigned int> g_textureColumnsRGBA[MAXMIPLEVELS]; // column-major for walls and sprites (texture column is contiguous)
+#define TEXTUREMIPCOLUMN(level,texture,column) (&g_textureColumnsRGBA[level][((texture)*(g_textureSize>>(level))+(column))*(g_textureSize>>(level))]) // first texel of texture column in mipmap level
+#define TEXTURECOLUMN(texture,column) TEXTUREMIPCOLUMN(0,texture,column)
+#define TRANSPARENTTEXEL RGBA(255,0,255) // special color for transparent or animated texels
+std::vector<unsigned int> g_animatedTexels; // color of special texels per texture in current frame (0 = transparent)
+// Opaque spans (runs without special texels) of every texture column for sprites
+struct TextureSpan {
+	unsigned short begin, end; // texture rows [begin;end[
+};
+std::vector<TextureSpan> g_textureSpans;
+std::vector<int> g_textureColumnSpans; // index of first span of every texture column in g_textureSpans (one more entry as end mark)
+std::vector<char> g_transparentTextures; // texture has special texels in any mipmap level (walls hide the background only with animated colors)
+int g_textureShift; // log2(g_textureSize)
+int g_mipLevels; // mipmap levels down to 1x1 texels
+#define BACKGROUNDGRAY 0.1f // gray of empty window areas
+
+// Map cell (texture number + 1, 0 = empty) in layers of g_mapWidth x g_mapHeight cells
+typedef unsigned char MapCell;
+#define MAPCELL(map,x,y) ((map)[(y)*g_mapWidth+(x)])
+int g_mapWidth; // width of map
+int g_mapHeight; // height of map
+int g_gridSize; // size of map cell in 2d view (0 = map too large for 2d view)
 
 // check if box in grid is filled with wall
-#define ISGRIDFILLED(x,y) ((g_wallMap[(int)y][(int)x]) > 0)
+#define ISGRIDFILLED(x,y) (MAPCELL(g_wallMap,(int)(x),(int)(y)) > 0)
 // check if position is within map
-#define ISGRIDINMAP(x,y) !(((int)x<0) || ((int)x > MAPWIDTH-1) || ((int)y< 0) || ((int)y > MAPHEIGHT-1))
+#define ISGRIDINMAP(x,y) !(((int)x<0) || ((int)x > g_mapWidth-1) || ((int)y< 0) || ((int)y > g_mapHeight-1))
 
+// Built-in level
+#define BUILTINMAPWIDTH 16
+#define BUILTINMAPHEIGHT 16
 // Map of walls
-const unsigned int g_defaultWallMap[MAPHEIGHT][MAPWIDTH]= {
+const MapCell g_builtinWallMap[BUILTINMAPHEIGHT][BUILTINMAPWIDTH]= {
  {  1, 1, 8, 1, 4, 1, 8, 1, 1,13, 1,13, 1,13,24, 1 },
  {  1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0,15, 0,26 },
  {  8, 0, 0, 0, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 0, 1 },
@@ -266,10 +575,9 @@ const unsigned int g_defaultWallMap[MAPHEIGHT][MAPWIDTH]= {
  {  8, 0, 0, 0, 0, 0,17, 0,22, 0, 0, 0, 0, 0, 0,13 },
  {  1,13, 1,24, 1,13, 1,16, 1, 1,13, 1,13, 1,13, 1 }
 };
-unsigned int g_wallMap[MAPHEIGHT][MAPWIDTH];
 
 // Floor map
-const unsigned int g_defaultFloorMap[MAPHEIGHT][MAPWIDTH]= {
+const MapCell g_builtinFloorMap[BUILTINMAPHEIGHT][BUILTINMAPWIDTH]= {
  { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 },
  { 5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,2 },
  { 5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,0 },
@@ -287,10 +595,9 @@ const unsigned int g_defaultFloorMap[MAPHEIGHT][MAPWIDTH]= {
  { 5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,0 },
  { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 }
 };	
-unsigned int g_floorMap[MAPHEIGHT][MAPWIDTH];
 
 // Roof map
-const unsigned int g_defaultRoofMap[MAPHEIGHT][MAPWIDTH]= {
+const MapCell g_builtinRoofMap[BUILTINMAPHEIGHT][BUILTINMAPWIDTH]= {
  { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 },
  { 7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,2 },
  { 7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,0 },
@@ -322,17 +629,196 @@ struct Sprite {
 	int openY; // y-pos of wall to be opened, if collected
 };
 
-#define MAXSPRITES 3
-Sprite g_sprites[MAXSPRITES] =
+// Sprites of built-in level
+const Sprite g_builtinSprites[] =
 {
 	{10.5, 14.5, TEXTUREWALLOPENER01,SPRITECOLLECTION+SPRITEOPENER,false,2,7},
 	{11.5,  5.5, TEXTUREWALLOPENER02,SPRITECOLLECTION+SPRITEOPENER,false,8,13},
 	{ 7.5, 14.5, TEXTUREWALLOPENER03,SPRITECOLLECTION+SPRITEOPENER,false,15,1}
 };
+std::vector<Sprite> g_sprites; // sprites of current level
+
+// Binary map format, version 1 (little endian):
+// MapHeader, wall, floor and roof layer (MAPLAYERSIZE bytes each, cells row by row), MapSprite records
+#define MAPMAGIC "F3DM"
+#define MAPVERSION 1
+#define MAXMAPSIZE 16384 // maximal width and height of map (floor coordinates up to map size + row distance in 16.16 fixed point)
+struct MapHeader {
+	char magic[4]; // MAPMAGIC
+	unsigned int version; // MAPVERSION
+	unsigned int width, height; // map size in cells
+	float startX, startY, startAngle; // viewer position and angle at game start
+	unsigned int finishX, finishY; // cell to finish the game
+	unsigned int spriteCount; // number of MapSprite records after the layers
+};
+struct MapSprite {
+	float x, y; // position of sprite
+	unsigned short texture, type; // texture and type (SPRITECOLLECTION and/or SPRITEOPENER)
+	unsigned short openX, openY; // wall to be opened, if collected
+};
+// layer size with at least 4 bytes padding (32 bit gathers of the last cell stay in the layer)
+#define MAPLAYERSIZE(width,height) ((((size_t)(width)*(height)+7)/4)*4)
+
+// Current level in binary map format (memory-mapped map file or built-in level)
+const char *g_mapFileName = NULL; // map file (NULL = built-in level)
+std::vector<unsigned char> g_mapBuffer; // built-in level (or map file without mmap)
+unsigned char *g_mapData = NULL;
+size_t g_mapDataSize = 0;
+bool g_mapDataMapped = false; // g_mapData is memory-mapped
+MapCell *g_wallMap; // walls of current level (changed when walls are opened)
+MapCell *g_floorMap; // floor of current level (changed near opened walls)
+const MapCell *g_roofMap; // roof of current level
+
+// Texture pack format, version 1 (little endian):
+// TexturePackHeader, RGB texels of every texture (textureSize x textureSize texels row by row, 255,0,255 = transparent or animated)
+#define TEXTUREPACKMAGIC "F3DT"
+#define TEXTUREPACKVERSION 1
+#define MAXTEXTURESIZE 4096 // maximal width and height of textures in texture pack
+#define MAXTEXTURETEXELS (1 << 26) // maximal texels of all textures in texture pack (packed colors and mipmaps need about 10 bytes per texel)
+#define TEXTUREPACKCHECKINTERVAL 500 // ms between checks for a changed texture pack file
+struct TexturePackHeader {
+	char magic[4]; // TEXTUREPACKMAGIC
+	unsigned int version; // TEXTUREPACKVERSION
+	unsigned int textureSize; // width and height of every texture (power of 2)
+	unsigned int textureCount; // number of textures
+};
+
+// Texture pack file in memory (textures are used in place)
+struct TexturePack {
+	std::vector<unsigned char> buffer; // file content without mmap
+	const unsigned char *data;
+	size_t size;
+	bool mapped; // data is memory-mapped
+};
+const char *g_texturePackFileName = NULL; // texture pack file (NULL = built-in textures)
+TexturePack g_texturePack = { std::vector<unsigned char>(), NULL, 0, false }; // current texture pack
+bool g_watchTexturePack = false; // reload texture pack when the file changes
+time_t g_texturePackModified; // modification time of texture pack file at last load
+long long g_texturePackFileSize; // size of texture pack file at last load
+int g_nextTexturePackCheckTime = 0;
+
+// Solid cells of wall map as bitmap for hit tests of the raycasters (call setSolid when a wall is opened)
+// The map is padded by a border of solid sentinel cells (map cell x,y is bitmap cell x+1,y+1), so rays stop without bounds checks.
+// Bitmap cells are stored in tiles of 8x8 cells (64 bits), a cache line of 8 tiles covers 64x8 cells.
+std::vector<unsigned long long> g_solidTiles;
+int g_solidTilesPerRow; // tiles in a row of the bitmap
+#define SOLIDTILE(px,py) (((py) >> 3)*g_solidTilesPerRow + ((px) >> 3))
+#define SOLIDBIT(px,py) ((((py) & 7) << 3) | ((px) & 7))
+// check if cell is solid (x,y within map or sentinel border [-1;g_mapWidth]x[-1;g_mapHeight])
+#define ISSOLID(x,y) ((g_solidTiles[SOLIDTILE((x)+1,(y)+1)] >> SOLIDBIT((x)+1,(y)+1)) & 1)
+// check if ray of old raycaster engine stops at crossing x,y (wall, sentinel border or beyond, one unsigned compare per axis)
+#define ISCROSSINGSTOP(x,y) (((unsigned int) ((int) (x) + 1) > (unsigned int) g_mapWidth) || ((unsigned int) ((int) (y) + 1) > (unsigned int) g_mapHeight) || ISSOLID((int) (x),(int) (y)))
+// Coarse level of bitmap for empty space skipping: one bit per tile (set = tile has solid cells) in blocks of 8x8 tiles,
+// so a block word 0 means 64x64 empty cells and a tile word 0 means 8x8 empty cells
+std::vector<unsigned long long> g_solidBlocks;
+int g_solidBlocksPerRow; // blocks in a row of the bitmap
+#define SOLIDBLOCK(px,py) (((py) >> 6)*g_solidBlocksPerRow + ((px) >> 6))
+
+// Uniform grid of sprites over map cells (call buildSpriteGrid after adding or moving sprites)
+// One grid cell covers 2^g_spriteGridShift x 2^g_spriteGridShift map cells, so large maps have at most SPRITEGRIDMAX x SPRITEGRIDMAX grid cells
+#define SPRITEGRIDMAX 256
+int g_spriteGridShift;
+int g_spriteGridWidth, g_spriteGridHeight; // size of grid in grid cells
+std::vector<int> g_spriteGridStart; // index of first sprite of every grid cell in g_spriteGrid (one more entry as end mark)
+std::vector<int> g_spriteGrid; // sprite numbers sorted by grid cell
+
+// buffers used to sort the visible sprites (reused every frame)
+std::vector<int> g_spriteOrder, g_spriteOrderTemp;
+std::vector<unsigned int> g_spriteDistance, g_spriteDistanceTemp; // sort key from squared distance (bigger key = nearer)
+#define SPRITEINSERTIONSORT 32 // insertion sort below this sprite count, radix sort above
+
+// sprites projected to screen in current frame (from farthest to nearest)
+struct SpriteProjection {
+	int texture; // texture
+	double transformY; // depth inside the screen
+	int screenX; // x-pos of sprite center on screen
+	int height; // height and width on screen
+	int drawStartX, drawEndX; // visible columns [drawStartX;drawEndX[
+	int drawStartY, drawEndY; // visible rows [drawStartY;drawEndY[
+};
+std::vector<SpriteProjection> g_spriteProjections;
+int g_spriteProjectionCount = 0;
+
+// Milliseconds since program start (without glut in headless mode)
+int getElapsedTime() {
+	static std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	if (g_frozenTime >= 0) return g_frozenTime;
+	if (!g_headless) return glutGet(GLUT_ELAPSED_TIME);
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-startTime).count();
+}
+
+// Begin a new frame for stage timing
+void beginFrameTiming() {
+	for (int i=0;i<STAGECOUNT;i++) g_stageTimes[i] = 0;
+}
+
+// Begin timing of a stage
+void beginStage() {
+	g_stageStartTime = std::chrono::steady_clock::now();
+}
+
+// Add time since begin of stage to stage (next stage begins now)
+void endStage(int stage) {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	g_stageTimes[stage] += std::chrono::duration<double,std::milli>(now-g_stageStartTime).count();
+	g_stageStartTime = now;
+}
+
+// Store stage times of finished frame in history and CSV file
+void endFrameTiming(double frameTime) {
+	int slot = g_timedFrames % TIMINGHISTORY;
+
+	for (int i=0;i<STAGECOUNT;i++) g_stageHistory[i][slot] = g_stageTimes[i];
+	g_stageHistory[STAGECOUNT][slot] = frameTime;
+	g_timedFrames++;
+
+	if (g_timingFile == NULL) return;
+	fprintf(g_timingFile,"%d,%d,%g",g_timedFrames,getElapsedTime(),g_pixelSize);
+	for (int i=0;i<STAGECOUNT;i++) fprintf(g_timingFile,",%.4f",g_stageTimes[i]);
+	fprintf(g_timingFile,",%.4f\n",frameTime);
+}
 
-//arrays used to sort the sprites
-int g_spriteOrder[MAXSPRITES];
-double g_spriteDistance[MAXSPRITES];
+// Rolling min, average and 99th percentile in ms of a stage (STAGECOUNT = whole frame) over the last frames
+void stageStatistics(int stage, double &minTime, double &avgTime, double &p99Time) {
+	float sorted[TIMINGHISTORY];
+	int count = std::min(g_timedFrames,TIMINGHISTORY);
+	double sum = 0;
+
+	minTime = avgTime = p99Time = 0;
+	if (count == 0) return;
+	memcpy(sorted,g_stageHistory[stage],count*sizeof(float));
+	std::sort(sorted,sorted+count);
+	for (int i=0;i<count;i++) sum += sorted[i];
+	minTime = sorted[0];
+	avgTime = sum/count;
+	p99Time = sorted[(count*99+99)/100-1]; // nearest rank
+}
+
+// Open CSV file for stage times and write header
+bool openTimingFile() {
+	g_timingFile = fopen(g_timingFileName,"w");
+	if (g_timingFile == NULL) return false;
+	fprintf(g_timingFile,"frame,time_ms,pixel_size");
+	for (int i=0;i<STAGECOUNT;i++) fprintf(g_timingFile,",%s_ms",g_stageNames[i]);
+	fprintf(g_timingFile,",frame_ms\n");
+	return true;
+}
+
+// Remember time when the current image gets outdated (sky rotation, animations, texts)
+void requestImageChange(int time) {
+	if (time < g_nextImageChangeTime) g_nextImageChangeTime = time;
+}
+
+// Resolve colors of special texels for current frame (once per frame, so pixel loops need no time query)
+void prepareAnimatedTexels() {
+	int time = getElapsedTime();
+
+	g_animatedTexels.assign(g_textureCount,0); // transparent by default
+	g_animatedTexels[TEXTURECANDLE] = RGBA(255-((time/10)&15),220-((time/10)&31),49); // candle
+	g_animatedTexels[TEXTURECOLORLINE] = RGBA((255-time/10)&255,0,0); // red color line
+}
 
 // Calculate direction vector and camera plane for DDA method
 void preparePositionDataForDDA() {
@@ -347,6 +833,391 @@ void preparePositionDataForDDA() {
 
 	g_cachedCos90 = cos(M_PI*(g_viewerAngle+90)/180)/vectorLength;
 	g_cachedSin90 = sin(M_PI*(g_viewerAngle+90)/180)/vectorLength;
+
+	g_dirXFixed = lround(g_cachedCos*FIXEDONE);
+	g_dirYFixed = lround(g_cachedSin*FIXEDONE);
+	g_planeXFixed = lround(g_cachedCos90*FIXEDONE);
+	g_planeYFixed = lround(g_cachedSin90*FIXEDONE);
+}
+
+// Fill ray angle tables for old raycaster engine
+void prepareRayAngleTables() {
+	// Angle step dependent on viewport aspect ratio and stripe width
+ 	float angleStep = g_viewPort3dWidth / (PREVEREDVIEWANGLE*((float) g_viewPort3dWidth/g_viewPort3dHeight));
+
+	for (int viewPortX=0;viewPortX<g_viewPort3dWidth;viewPortX++) {
+		float angle = - ((g_viewPort3dWidth-1)/2 - viewPortX) / angleStep;
+		g_rayAngleCos[viewPortX] = cos(M_PI*angle/180);
+		g_rayAngleSin[viewPortX] = sin(M_PI*angle/180);
+	}
+}
+
+// Fill camera space table for fixed point DDA raycaster
+void prepareCameraTableFixed() {
+	for (int x=0;x<g_viewPort3dWidth;x++) g_cameraXFixed[x] = lround((2 * x / double(g_viewPort3dWidth) - 1)*FIXEDONE);
+}
+
+// Fill reciprocal table for fixed point DDA raycaster
+void prepareReciprocalTable() {
+	for (int i=0;i<=(1 << RECIPROCALBITS);i++) g_reciprocalTable[i] = lround(2147483648.0/(1+(double) i/(1 << RECIPROCALBITS)));
+}
+
+// 2^32/value (reciprocal of a 16.16 value as 16.16 value), by reciprocal table with linear interpolation (relative error < 2^-21). Saturates for value <= 1.
+inline unsigned int reciprocalFixed(unsigned int value) {
+	if (value <= 1) return 0xffffffff;
+	int top = 31 - __builtin_clz(value); // value = 2^top * mantissa
+	unsigned int mantissa = value << (31-top); // 1.31
+	unsigned int index = (mantissa >> (31-RECIPROCALBITS)) & ((1 << RECIPROCALBITS)-1);
+	unsigned int weight = (mantissa >> (15-RECIPROCALBITS)) & 0xffff; // next 16 bits of mantissa
+	unsigned int a = g_reciprocalTable[index], b = g_reciprocalTable[index+1];
+	return (a - (unsigned int) (((unsigned long long) (a-b)*weight) >> 16)) >> (top-1);
+}
+
+// Fill light tables
+void prepareLightTables() {
+	for (int level=0;level<LIGHTLEVELS;level++) {
+		for (int value=0;value<256;value++) g_lightTable[level][value] = value*level/FULLLIGHT;
+	}
+}
+
+// Light level for darken factor (half brightness for wall side)
+inline int lightLevel(float darken, bool side = false) {
+	int level = FULLLIGHT/darken + 0.5f;
+	if (level > FULLLIGHT) level = FULLLIGHT;
+	if (level < 0) level = 0;
+	if (side) level /= 2;
+	return level;
+}
+
+// Light level for 16.16 darken factor (same as lightLevel)
+inline int lightLevelFixed(unsigned int darken, bool side = false) {
+	int level = ((unsigned long long) FULLLIGHT*reciprocalFixed(darken) + FIXEDONE/2) >> FIXEDSHIFT;
+	if (level > FULLLIGHT) level = FULLLIGHT;
+	if (side) level /= 2;
+	return level;
+}
+
+// Mipmap level for wall stripe of lineHeight pixels (one level per halving of the texture pixels per screen pixel)
+inline int wallMipLevel(int lineHeight) {
+	int level = 0;
+	if (!g_useMipmaps) return 0;
+	while ((level < g_mipLevels-1) && ((lineHeight <= 1) || ((lineHeight-1) << (level+1) <= g_textureSize))) level++; // very far walls have height 0
+	return level;
+}
+
+// Height of DDA wall stripe for perpendicular wall distance (even for better symmetry)
+inline int wallLineHeight(double perpWallDist) {
+	int lineHeight = (int)(g_viewPort3dHeight / perpWallDist); // +4 in my case to fill the gaps between wall, floor and roof (or add floor and roof also for walls)
+	if (lineHeight & 1) lineHeight ++; // odd height for better symetry
+	return lineHeight;
+}
+
+// Height of fixed point DDA wall stripe for 16.16 perpendicular wall distance (same as wallLineHeight)
+inline int wallLineHeightFixed(unsigned int perpWallDist) {
+	int lineHeight = ((unsigned long long) g_viewPort3dHeight*reciprocalFixed(perpWallDist)) >> FIXEDSHIFT;
+	if (lineHeight & 1) lineHeight ++; // odd height for better symetry
+	return lineHeight;
+}
+
+// Background rows (counted from horizon) hidden by wall stripe of lineHeight pixels, above and below the horizon (0 when the wall shows the background through special texels)
+inline int wallCover(int lineHeight, int texture) {
+	if (lineHeight < 2) return 0; // wall too small, not drawn
+	if (g_showTextures && g_transparentTextures[texture] && (g_animatedTexels[texture] == 0)) return 0;
+	int drawStart = std::max(-lineHeight / 2 + g_viewPort3dHalfHeight,0);
+	int drawEnd = std::min(lineHeight / 2 + g_viewPort3dHalfHeight,g_viewPort3dHeight);
+	return std::max(std::min(drawEnd - g_viewPort3dHalfHeight,g_viewPort3dHalfHeight - drawStart),0);
+}
+
+// Convert textures to packed colors and build mipmap levels
+void prepareTextures() {
+	for (g_textureShift=0;(1 << g_textureShift) < g_textureSize;g_textureShift++);
+	g_mipLevels = g_textureShift+1;
+	if (g_mipLevels > MAXMIPLEVELS) g_mipLevels = MAXMIPLEVELS;
+
+	g_texturesRGBA[0].resize(g_textureCount*g_textureSize*g_textureSize);
+	g_textureColumnsRGBA[0].resize(g_textureCount*g_textureSize*g_textureSize);
+	for (int texture=0;texture<g_textureCount;texture++) {
+		for (int y=0;y<g_textureSize;y++) {
+			for (int x=0;x<g_textureSize;x++) {
+				int pixel = (y*g_textureSize+x)*3;
+				unsigned int color = RGBA(g_textures[texture][pixel],g_textures[texture][pixel+1],g_textures[texture][pixel+2]);
+				g_texturesRGBA[0][(texture*g_textureSize+y)*g_textureSize+x] = color;
+				g_textureColumnsRGBA[0][(texture*g_textureSize+x)*g_textureSize+y] = color;
+			}
+		}
+	}
+
+	// every level is the 2x2 box filtered previous level, transparent when at least half of the 2x2 texels are transparent
+	for (int level=1;level<g_mipLevels;level++) {
+		int size = g_textureSize >> level;
+		const unsigned int *source = &g_texturesRGBA[level-1][0];
+		g_texturesRGBA[level].resize(g_textureCount*size*size);
+		g_textureColumnsRGBA[level].resize(g_textureCount*size*size);
+		for (int texture=0;texture<g_textureCount;texture++) {
+			for (int y=0;y<size;y++) {
+				for (int x=0;x<size;x++) {
+					unsigned int texels[4], color;
+					int red = 0, green = 0, blue = 0, opaque = 0;
+					texels[0] = source[(texture*2*size+2*y)*2*size+2*x];
+					texels[1] = source[(texture*2*size+2*y)*2*size+2*x+1];
+					texels[2] = source[(texture*2*size+2*y+1)*2*size+2*x];
+					texels[3] = source[(texture*2*size+2*y+1)*2*size+2*x+1];
+					for (int i=0;i<4;i++) {
+						if (texels[i] == TRANSPARENTTEXEL) continue;
+						red += texels[i] & 0xff;
+						green += (texels[i] >> 8) & 0xff;
+						blue += (texels[i] >> 16) & 0xff;
+						opaque++;
+					}
+					if (opaque > 2) color = RGBA((red+opaque/2)/opaque,(green+opaque/2)/opaque,(blue+opaque/2)/opaque); else color = TRANSPARENTTEXEL;
+					g_texturesRGBA[level][(texture*size+y)*size+x] = color;
+					g_textureColumnsRGBA[level][(texture*size+x)*size+y] = color;
+				}
+			}
+		}
+	}
+
+	// textures with special texels
+	g_transparentTextures.assign(g_textureCount,false);
+	for (int level=0;level<g_mipLevels;level++) {
+		int texels = (g_textureSize >> level)*(g_textureSize >> level);
+		for (int i=0;i<g_textureCount*texels;i++) {
+			if (g_texturesRGBA[level][i] == TRANSPARENTTEXEL) g_transparentTextures[i/texels] = true;
+		}
+	}
+
+	// run-length encode special texels of every texture column
+	g_textureSpans.clear();
+	g_textureColumnSpans.resize(g_textureCount*g_textureSize+1);
+	for (int column=0;column<g_textureCount*g_textureSize;column++) {
+		const unsigned int *texels = &g_textureColumnsRGBA[0][column*g_textureSize];
+		g_textureColumnSpans[column] = g_textureSpans.size();
+		for (int y=0;y<g_textureSize;y++) {
+			if (texels[y] == TRANSPARENTTEXEL) continue;
+			TextureSpan span;
+			span.begin = y;
+			while ((y < g_textureSize) && (texels[y] != TRANSPARENTTEXEL)) y++;
+			span.end = y;
+			g_textureSpans.push_back(span);
+		}
+	}
+	g_textureColumnSpans[g_textureCount*g_textureSize] = g_textureSpans.size();
+	g_sceneChanges++;
+}
+
+// Begin drawing pixels of 3d view (only needed when drawing pixels as OpenGL points)
+void beginPixels() {
+	if (g_useFrameBuffer) return;
+	glPointSize(g_pixelSize);
+	glBegin(GL_POINTS);
+}
+
+// End drawing pixels of 3d view
+void endPixels() {
+	if (!g_useFrameBuffer) glEnd();
+}
+
+// Draw pixel at 3d view position into CPU framebuffer or as OpenGL point
+inline void drawPixel(int viewPortX, int viewPortY, int red, int green, int blue) {
+	if (g_useFrameBuffer) {
+		g_frameBuffer[viewPortY*g_viewPort3dWidth+viewPortX] = RGBA(red,green,blue);
+	} else {
+		glColor3ub(red,green,blue);
+		glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,viewPortY*g_pixelSize+g_pixelOffset);
+	}
+}
+
+// Fill stripe [beginY;endY[ of a 3d view column in CPU framebuffer
+void fillFrameBufferColumn(int viewPortX, int beginY, int endY, unsigned int color) {
+	if (beginY < 0) beginY = 0;
+	if (endY > g_viewPort3dHeight) endY = g_viewPort3dHeight;
+	unsigned int *pixel = &g_frameBuffer[beginY*g_viewPort3dWidth+viewPortX];
+	for (int viewPortY=beginY;viewPortY<endY;viewPortY++) {
+		*pixel = color;
+		pixel += g_viewPort3dWidth;
+	}
+}
+
+// Fill rows [beginY;endY[ of CPU framebuffer
+void fillFrameBufferRows(int beginY, int endY, unsigned int color) {
+	std::fill(g_frameBuffer.begin()+beginY*g_viewPort3dWidth,g_frameBuffer.begin()+endY*g_viewPort3dWidth,color);
+}
+
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F // OpenGL 1.2, missing in old Windows headers
+#endif
+// Upload CPU framebuffer into a texture and draw it scaled by pixel size (bilinear filtered for fractional pixel sizes)
+void presentFrameBuffer() {
+	static GLuint texture = 0;
+	static int textureWidth = 0, textureHeight = 0; // power of two size for old OpenGL versions
+	int width = g_viewPort3dWidth, height = g_viewPort3dHeight;
+
+	if (texture == 0) glGenTextures(1,&texture);
+	glBindTexture(GL_TEXTURE_2D,texture);
+	if ((width >= textureWidth) || (height >= textureHeight)) { // one spare column and row for border
+		for (textureWidth=1;textureWidth <= width;textureWidth*=2);
+		for (textureHeight=1;textureHeight <= height;textureHeight*=2);
+		glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA,textureWidth,textureHeight,0,GL_RGBA,GL_UNSIGNED_BYTE,NULL);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+	}
+	GLint filter = (g_pixelSize == (int) g_pixelSize) ? GL_NEAREST : GL_LINEAR;
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,filter);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,filter);
+
+	// upload columns rendered in this frame (all columns of a complete frame)
+	int beginX = g_changedBeginX, endX = g_changedEndX;
+	if (beginX < endX) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH,width);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS,beginX);
+		glTexSubImage2D(GL_TEXTURE_2D,0,beginX,0,endX-beginX,height,GL_RGBA,GL_UNSIGNED_BYTE,&g_frameBuffer[0]);
+		// repeat last row and column, so bilinear filtering at the right and lower border does not blend undefined texels
+		glTexSubImage2D(GL_TEXTURE_2D,0,beginX,height,endX-beginX,1,GL_RGBA,GL_UNSIGNED_BYTE,&g_frameBuffer[(height-1)*width]);
+		if (endX == width) {
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS,width-1);
+			glTexSubImage2D(GL_TEXTURE_2D,0,width,0,1,height,GL_RGBA,GL_UNSIGNED_BYTE,&g_frameBuffer[0]);
+			glTexSubImage2D(GL_TEXTURE_2D,0,width,height,1,1,GL_RGBA,GL_UNSIGNED_BYTE,&g_frameBuffer[(height-1)*width]);
+		}
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS,0);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+	}
+
+	// quad from upper left corner of 3d view (framebuffer starts with upper row like the window coordinates)
+	float left = g_viewPort3dOffsetX-0.5f, top = -0.5f;
+	float right = left + width*g_pixelSize, bottom = top + height*g_pixelSize;
+	float textureRight = (float) width/textureWidth, textureBottom = (float) height/textureHeight;
+	glEnable(GL_TEXTURE_2D);
+	glColor3f(1,1,1);
+	glBegin(GL_QUADS);
+	glTexCoord2f(0,0); glVertex2f(left,top);
+	glTexCoord2f(textureRight,0); glVertex2f(right,top);
+	glTexCoord2f(textureRight,textureBottom); glVertex2f(right,bottom);
+	glTexCoord2f(0,textureBottom); glVertex2f(left,bottom);
+	glEnd();
+	glDisable(GL_TEXTURE_2D);
+}
+
+// Frame job system: persistent worker threads split a frame stage into bands of columns or rows.
+// Every band has its own framebuffer area, so the frame is identical for any thread count and scheduling.
+#define JOBBANDSPERTHREAD 8 // bands per thread, more bands make work stealing more balanced
+struct BandQueue {
+	std::mutex mutex;
+	std::deque<int> bands;
+};
+std::vector<std::thread> g_jobWorkers; // worker threads (main thread is thread 0)
+BandQueue *g_jobQueues = NULL; // one band queue per thread
+std::mutex g_jobMutex;
+std::condition_variable g_jobStart;
+std::condition_variable g_jobDone;
+int g_jobGeneration = 0; // incremented for every stage
+bool g_jobQuit = false;
+void (*g_jobFunction)(int,int); // function for band [begin;end[
+int g_jobCount; // columns or rows of current stage
+int g_jobBandSize; // columns or rows per band
+std::atomic<int> g_jobBandsPending(0);
+
+// Process bands from own queue, then steal bands from the other queues
+void runJobBands(int threadIndex) {
+	int threads = g_jobWorkers.size()+1;
+	int band;
+	bool found;
+
+	while (true) {
+		found = false;
+		for (int i=0;(i<threads) && !found;i++) {
+			BandQueue &queue = g_jobQueues[(threadIndex+i)%threads];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.bands.empty()) continue;
+			if (i == 0) { // own queue from front
+				band = queue.bands.front();
+				queue.bands.pop_front();
+			} else { // steal from back
+				band = queue.bands.back();
+				queue.bands.pop_back();
+			}
+			found = true;
+		}
+		if (!found) return;
+
+		g_jobFunction(band*g_jobBandSize,std::min((band+1)*g_jobBandSize,g_jobCount));
+		if (--g_jobBandsPending == 0) {
+			std::lock_guard<std::mutex> lock(g_jobMutex);
+			g_jobDone.notify_one();
+		}
+	}
+}
+
+// Worker thread loop
+void jobWorker(int threadIndex) {
+	int generation = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(g_jobMutex);
+			while (!g_jobQuit && (generation == g_jobGeneration)) g_jobStart.wait(lock);
+			if (g_jobQuit) return;
+			generation = g_jobGeneration;
+		}
+		runJobBands(threadIndex);
+	}
+}
+
+// Stop worker threads (at program exit)
+void stopJobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(g_jobMutex);
+		g_jobQuit = true;
+	}
+	g_jobStart.notify_all();
+	for (unsigned int i=0;i<g_jobWorkers.size();i++) g_jobWorkers[i].join();
+	g_jobWorkers.clear();
+	delete[] g_jobQueues;
+	g_jobQueues = NULL;
+}
+
+// Start worker threads
+void startJobSystem() {
+	int threads = g_threadCount;
+
+	if (threads < 1) threads = std::thread::hardware_concurrency();
+	if (threads < 1) threads = 1;
+	g_threadCount = threads;
+
+	g_jobQueues = new BandQueue[threads];
+	for (int i=1;i<threads;i++) g_jobWorkers.push_back(std::thread(jobWorker,i));
+	atexit(stopJobSystem);
+}
+
+// Run function for [0;count[ split into bands on all threads and wait until all bands are done
+void parallelFor(int count, void (*function)(int,int)) {
+	int threads = g_jobWorkers.size()+1;
+	int bands = threads*JOBBANDSPERTHREAD;
+
+	if ((threads == 1) || (count < bands)) { // not worth splitting
+		function(0,count);
+		return;
+	}
+
+	g_jobFunction = function;
+	g_jobCount = count;
+	g_jobBandSize = (count+bands-1)/bands;
+	bands = (count+g_jobBandSize-1)/g_jobBandSize;
+	g_jobBandsPending = bands;
+	for (int band=0;band<bands;band++) { // neighboring bands to same thread for better cache usage
+		BandQueue &queue = g_jobQueues[band*threads/bands];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.bands.push_back(band);
+	}
+	{
+		std::lock_guard<std::mutex> lock(g_jobMutex);
+		g_jobGeneration++;
+	}
+	g_jobStart.notify_all();
+
+	runJobBands(0);
+
+	std::unique_lock<std::mutex> lock(g_jobMutex);
+	while (g_jobBandsPending > 0) g_jobDone.wait(lock);
 }
 
 // Draw 2D map
@@ -354,13 +1225,13 @@ void drawMap() {
 	// Grid to show walls
 	glBegin(GL_QUADS);
 
-	for (int x=0;x<MAPWIDTH;x++) {
-		for (int y=0;y<MAPHEIGHT;y++) {
-			if (g_wallMap[y][x] > 0) glColor3f(0.5,0.5,0.5); else glColor3f(1,1,1);
-			glVertex2i(x*GRIDSIZE + 1,y*GRIDSIZE+1);
-			glVertex2i((x+1)*GRIDSIZE - 1,y*GRIDSIZE+1);
-			glVertex2i((x+1)*GRIDSIZE - 1,(y+1)*GRIDSIZE-1);
-			glVertex2i(x*GRIDSIZE + 1,(y+1)*GRIDSIZE-1);
+	for (int x=0;x<g_mapWidth;x++) {
+		for (int y=0;y<g_mapHeight;y++) {
+			if (MAPCELL(g_wallMap,x,y) > 0) glColor3f(0.5,0.5,0.5); else glColor3f(1,1,1);
+			glVertex2i(x*g_gridSize + 1,y*g_gridSize+1);
+			glVertex2i((x+1)*g_gridSize - 1,y*g_gridSize+1);
+			glVertex2i((x+1)*g_gridSize - 1,(y+1)*g_gridSize-1);
+			glVertex2i(x*g_gridSize + 1,(y+1)*g_gridSize-1);
 		}
 	}
 	glEnd();
@@ -371,73 +1242,27 @@ void drawViewer() {
 	// quad at position
 	glColor3f(0,0,1);
 	glBegin(GL_QUADS);
-	glVertex2i((g_viewerX*GRIDSIZE-VIEWERBOXSIZE/2),(g_viewerY*GRIDSIZE-VIEWERBOXSIZE/2));
-	glVertex2i((g_viewerX*GRIDSIZE+VIEWERBOXSIZE/2),(g_viewerY*GRIDSIZE-VIEWERBOXSIZE/2));
-	glVertex2i((g_viewerX*GRIDSIZE+VIEWERBOXSIZE/2),(g_viewerY*GRIDSIZE+VIEWERBOXSIZE/2));
-	glVertex2i((g_viewerX*GRIDSIZE-VIEWERBOXSIZE/2),(g_viewerY*GRIDSIZE+VIEWERBOXSIZE/2));
+	glVertex2i((g_viewerX*g_gridSize-VIEWERBOXSIZE/2),(g_viewerY*g_gridSize-VIEWERBOXSIZE/2));
+	glVertex2i((g_viewerX*g_gridSize+VIEWERBOXSIZE/2),(g_viewerY*g_gridSize-VIEWERBOXSIZE/2));
+	glVertex2i((g_viewerX*g_gridSize+VIEWERBOXSIZE/2),(g_viewerY*g_gridSize+VIEWERBOXSIZE/2));
+	glVertex2i((g_viewerX*g_gridSize-VIEWERBOXSIZE/2),(g_viewerY*g_gridSize+VIEWERBOXSIZE/2));
 	glEnd();
 	
 	// line in view direction
 	glLineWidth(1);
 	glBegin(GL_LINES);
-	glVertex2i(g_viewerX*GRIDSIZE,g_viewerY*GRIDSIZE);
-	glVertex2i((g_viewerX*GRIDSIZE+cos(M_PI*g_viewerAngle/180)*VIEWERBOXSIZE*4),(g_viewerY*GRIDSIZE+sin(M_PI*g_viewerAngle/180)*VIEWERBOXSIZE*4));
+	glVertex2i(g_viewerX*g_gridSize,g_viewerY*g_gridSize);
+	glVertex2i((g_viewerX*g_gridSize+cos(M_PI*g_viewerAngle/180)*VIEWERBOXSIZE*4),(g_viewerY*g_gridSize+sin(M_PI*g_viewerAngle/180)*VIEWERBOXSIZE*4));
 	glEnd();						
 }
 
-// Draw sky, ground, floor and roof (floor and roof based on https://lodev.org/cgtutor/raycasting.html, (c) 2004-2021, Lode Vandevenne)
-void drawBackground() {
-	float deltaY,darken;
+// Draw floor, roof, sky and ground for screen rows [beginY;endY[ above and below the horizon
+void drawBackgroundRows(int beginY, int endY) {
+	const unsigned char *light;
 	int pixel, red, green, blue, texture;
-	int textureSkyGroundDeltaX = 0;
-	static GLint autoSkyRotateTime = 0;
-	static int autoSkyRotate = 0;
 	bool isInMap = false;
-	
-	if (!g_showBackground) { // draw floor if background is not disabled
-		
-		if (!g_roundPixels) { // quad pixels
-			// floor plane
-			glLineWidth(1);
-			glColor3f(0.4,0.4,0.4);
-			glBegin(GL_QUADS);
-			glVertex2i(g_viewPort3dOffsetX,g_pixelSize*g_viewPort3dHeight/2);
-			glVertex2i(g_viewPort3dOffsetX+g_pixelSize*g_viewPort3dWidth,g_pixelSize*g_viewPort3dHeight/2);
-			glVertex2i(g_viewPort3dOffsetX+g_pixelSize*g_viewPort3dWidth,g_pixelSize*g_viewPort3dHeight-1);
-			glVertex2i(g_viewPort3dOffsetX,g_pixelSize*g_viewPort3dHeight-1);
-			glEnd();
-		} else { // round pixels
-			glPointSize(g_pixelSize);
-			glColor3f(0.4,0.4,0.4);
-
-			glBegin(GL_POINTS);
 
-	      	for (int viewPortX=0;viewPortX<g_viewPort3dWidth;viewPortX++) {
-   		      	for (int viewPortY=0;viewPortY<g_viewPort3dHalfHeight;viewPortY++) {
-					glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHalfHeight)*g_pixelSize+viewPortY*g_pixelSize+g_pixelOffset);
-				}
-			}
-			glEnd();
-		}	
-	}
-	
-	if (g_oldStyle)	return; // old style raycaster makes sky by himself
-	
-	if (!g_showBackground) return;
-
-	if (glutGet(GLUT_ELAPSED_TIME) - autoSkyRotateTime > 100) { // move sky every 100 ms one texture pixel
-		autoSkyRotate++;
-		autoSkyRotateTime=glutGet(GLUT_ELAPSED_TIME);
-	}
-
-	int textureSkyGroundOffsetViewer = (float) (6*SKYSCALE*TEXTURESIZE*g_viewerAngle/360); // texture offset for ground and sky, dependent on viewer rotation	
-	int textureSkyGroundOffsetAutoRotate = (autoSkyRotate+ textureSkyGroundOffsetViewer/SKYSCALE)%TEXTURESIZE; // texture pixel offset for ground and sky, dependent on viewer rotation and time
-	int textureSkyGroundOffsetStatic = (textureSkyGroundOffsetViewer/SKYSCALE)%TEXTURESIZE; // texture pixel offset for ground and sky, dependent on viewer rotation
-
-	glPointSize(g_pixelSize);
-	glBegin(GL_POINTS);				
-	
-	for (int viewPortY = 0;viewPortY < g_viewPort3dHalfHeight;viewPortY++) {
+	for (int viewPortY = beginY;viewPortY < endY;viewPortY++) {
 		// rayDir for leftmost ray (x = 0) and rightmost ray (x = w)
       	float rayDirX0 = g_cachedCos - g_cachedCos90;
       	float rayDirY0 = g_cachedSin - g_cachedSin90;
@@ -458,6 +1283,7 @@ void drawBackground() {
       	float floorY = g_viewerY + rowDistance * rayDirY0;
       	
 		float textureSkyGroundDeltaX = 0;
+		light = g_lightTable[lightLevel(1+100.0f/((viewPortY+1)*g_pixelSize))];
 
       	for (int viewPortX=0;viewPortX<g_viewPort3dWidth;viewPortX++) {
 			
@@ -466,330 +1292,1135 @@ void drawBackground() {
         	int cellY = (int)(floorY);
 
         	// get the texture coordinate from the fractional part
-        	int tx = (int)(TEXTURESIZE*(floorX - cellX)) & (TEXTURESIZE - 1);
-        	int ty = (int)(TEXTURESIZE*(floorY - cellY)) & (TEXTURESIZE - 1);
+        	int tx = (int)(g_textureSize*(floorX - cellX)) & (g_textureSize - 1);
+        	int ty = (int)(g_textureSize*(floorY - cellY)) & (g_textureSize - 1);
         
         	isInMap = ISGRIDINMAP(floorX,floorY);
-			darken = (float) 1+100.0f/((viewPortY+1)*g_pixelSize);
 			textureSkyGroundDeltaX += g_textureSkyGroundStepX;
 
 			// Floor
 			if (isInMap) {		
-				texture = g_floorMap[(int)(floorY)][(int)(floorX)];
+				texture = MAPCELL(g_floorMap,(int)(floorX),(int)(floorY));
 			
 				if (texture > 0 && g_showTextures && g_showBackgroundTexture) {		
-					pixel = (ty*TEXTURESIZE + tx)*3;
+					pixel = (ty*g_textureSize + tx)*3;
 		
 			        red = g_textures[texture-1][pixel];
 			        green = g_textures[texture-1][pixel+1];
 			        blue = g_textures[texture-1][pixel+2];
 					
-					glColor3ub(red/darken,green/darken,blue/darken);
-					glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHalfHeight)*g_pixelSize+viewPortY*g_pixelSize+g_pixelOffset);
+					drawPixel(viewPortX,g_viewPort3dHalfHeight+viewPortY,light[red],light[green],light[blue]);
 				}
 				if (texture > 0 && (!g_showTextures || !g_showBackgroundTexture)) {		
-					glColor3ub(255/darken,0,255/darken);
-					glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHalfHeight)*g_pixelSize+viewPortY*g_pixelSize+g_pixelOffset);
+					drawPixel(viewPortX,g_viewPort3dHalfHeight+viewPortY,light[255],0,light[255]);
 				}
 			}
 			
 			// Ground
 			if (!isInMap || (texture == 0 )) {
 				if (g_showTextures) {
-					int pixel=(((g_pixelSize*viewPortY/SKYSCALE)%TEXTURESIZE)*TEXTURESIZE+(textureSkyGroundOffsetStatic+(int) textureSkyGroundDeltaX)%TEXTURESIZE)*3;
+					int pixel=((((int) (g_pixelSize*viewPortY/SKYSCALE))%g_textureSize)*g_textureSize+(g_textureSkyGroundOffsetStatic+(int) textureSkyGroundDeltaX)%g_textureSize)*3;
 					int red   =g_textures[TEXTUREGROUND][pixel+0];
 					int green =g_textures[TEXTUREGROUND][pixel+1];
 					int blue  =g_textures[TEXTUREGROUND][pixel+2];
-					glColor3ub(red/darken,green/darken,blue/darken);
-				} else glColor3ub(0,255/darken,255/darken);
-				glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHalfHeight)*g_pixelSize+viewPortY*g_pixelSize+g_pixelOffset);
+					drawPixel(viewPortX,g_viewPort3dHalfHeight+viewPortY,light[red],light[green],light[blue]);
+				} else drawPixel(viewPortX,g_viewPort3dHalfHeight+viewPortY,0,light[255],light[255]);
 			}
 
 			// Roof
 			if (isInMap) {
-				texture = g_defaultRoofMap[(int)floorY][(int)floorX];
+				texture = MAPCELL(g_roofMap,(int)floorX,(int)floorY);
 		
 				if (texture > 0 && g_showTextures && g_showBackgroundTexture) {		
-					pixel = (ty*TEXTURESIZE + tx)*3;
+					pixel = (ty*g_textureSize + tx)*3;
 		
 			        red = g_textures[texture-1][pixel];
 			        green = g_textures[texture-1][pixel+1];
 			        blue = g_textures[texture-1][pixel+2];
 					
-					glColor3ub(red/darken,green/darken,blue/darken);
-					glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHalfHeight-1)*g_pixelSize-viewPortY*g_pixelSize+g_pixelOffset);
+					drawPixel(viewPortX,g_viewPort3dHalfHeight-1-viewPortY,light[red],light[green],light[blue]);
 				}
 				if (texture > 0 && (!g_showTextures || !g_showBackgroundTexture)) {		
-					glColor3ub(255/darken,255/darken,0);
-					glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHalfHeight-1)*g_pixelSize-viewPortY*g_pixelSize+g_pixelOffset);
+					drawPixel(viewPortX,g_viewPort3dHalfHeight-1-viewPortY,light[255],light[255],0);
 				}				
 			}
 
 			// Sky
 			if (!isInMap || (texture == 0 )) {
 				if (g_showTextures) {
-					int pixel=(((g_pixelSize*viewPortY/SKYSCALE)%TEXTURESIZE)*TEXTURESIZE+(textureSkyGroundOffsetAutoRotate+(int) textureSkyGroundDeltaX)%TEXTURESIZE)*3;
+					int pixel=((((int) (g_pixelSize*viewPortY/SKYSCALE))%g_textureSize)*g_textureSize+(g_textureSkyGroundOffsetAutoRotate+(int) textureSkyGroundDeltaX)%g_textureSize)*3;
 					int red   =g_textures[TEXTURESKY][pixel+0];
 					int green =g_textures[TEXTURESKY][pixel+1];
 					int blue  =g_textures[TEXTURESKY][pixel+2];
 	
-					glColor3ub(red/darken,green/darken,blue/darken);
-				} else glColor3ub(0,0,255/darken);
-				glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHalfHeight-1)*g_pixelSize-viewPortY*g_pixelSize+g_pixelOffset);
+					drawPixel(viewPortX,g_viewPort3dHalfHeight-1-viewPortY,light[red],light[green],light[blue]);
+				} else drawPixel(viewPortX,g_viewPort3dHalfHeight-1-viewPortY,0,0,light[255]);
 			}
 
     		floorX += floorStepX;
         	floorY += floorStepY;
 		}
 	}
-	glEnd(); 	
-}
-
-// Get RGB for texture pixel
-bool getTextureColor(int texture, bool side, int pixel, float darken, int &red, int &green, int &blue) {
-	red = g_textures[texture][pixel];
-	green = g_textures[texture][pixel + 1];
-	blue = g_textures[texture][pixel + 2];
-	if ((red == 255) && (green == 0) && (blue == 255)) { // special color
-		if (texture==TEXTURECANDLE) { // candle
-			red = 255-((glutGet(GLUT_ELAPSED_TIME)/10)&15);
-			green = 220-((glutGet(GLUT_ELAPSED_TIME)/10)&31);
-			blue = 49;
-			red/=darken;
-			green/=darken;
-			blue/=darken;
-			if (side) {
-				red/=2;
-				green/=2;
-				blue/=2;	
-			}
-			return true;
+}
+
+// Prepare fixed point values for background row viewPortY (same floor geometry as drawBackgroundRows)
+void prepareBackgroundRow(int viewPortY, BackgroundRow &row) {
+	// rayDir for leftmost ray (x = 0) and rightmost ray (x = w)
+	float rayDirX0 = g_cachedCos - g_cachedCos90;
+	float rayDirY0 = g_cachedSin - g_cachedSin90;
+	float rayDirX1 = g_cachedCos + g_cachedCos90;
+	float rayDirY1 = g_cachedSin + g_cachedSin90;
+
+	// Horizontal distance from the camera to the floor for the current row.
+	double rowDistance = (double) g_viewPort3dHalfHeight / (viewPortY+1);
+
+	row.floorX = (g_viewerX + rowDistance * rayDirX0) * 65536;
+	row.floorY = (g_viewerY + rowDistance * rayDirY0) * 65536;
+	row.stepX = rowDistance * (rayDirX1 - rayDirX0) / g_viewPort3dWidth * 65536;
+	row.stepY = rowDistance * (rayDirY1 - rayDirY0) / g_viewPort3dWidth * 65536;
+	row.shade = 256 / (1+100.0f/((viewPortY+1)*g_pixelSize));
+	row.groundTexel = TEXTUREGROUND*g_textureSize*g_textureSize + (((int) (g_pixelSize*viewPortY/SKYSCALE))%g_textureSize)*g_textureSize;
+	row.skyTexel = TEXTURESKY*g_textureSize*g_textureSize + (((int) (g_pixelSize*viewPortY/SKYSCALE))%g_textureSize)*g_textureSize;
+	row.skyGroundStep = g_textureSkyGroundStepX * 65536;
+
+	// mipmap level by texture pixels per screen pixel across the row and to the next row
+	row.mipLevel = 0;
+	if (g_useMipmaps) {
+		double footprint = rowDistance * fmax(fabs(rayDirX1 - rayDirX0),fabs(rayDirY1 - rayDirY0)) / g_viewPort3dWidth;
+		footprint = fmax(footprint,rowDistance - (double) g_viewPort3dHalfHeight / (viewPortY+2)) * g_textureSize;
+		while ((row.mipLevel < g_mipLevels-1) && (footprint >= (2 << row.mipLevel))) row.mipLevel++;
+	}
+	row.floorLine = &g_frameBuffer[(g_viewPort3dHalfHeight+viewPortY)*g_viewPort3dWidth];
+	row.roofLine = &g_frameBuffer[(g_viewPort3dHalfHeight-1-viewPortY)*g_viewPort3dWidth];
+}
+
+// Draw columns [beginX;endX[ of background row pixel by pixel (all texture settings)
+void drawBackgroundSpanScalar(const BackgroundRow &row, int beginX, int endX) {
+	const unsigned int *textures = &g_texturesRGBA[0][0];
+	const unsigned int *floorTextures = &g_texturesRGBA[row.mipLevel][0];
+	bool texturedFloor = g_showTextures && g_showBackgroundTexture;
+	int mipShift = g_textureShift - row.mipLevel;
+	int mipSize = 1 << mipShift;
+	int textureMask = g_textureSize-1;
+	int textureShift = 16 - mipShift;
+	int floorX = row.floorX + beginX*row.stepX;
+	int floorY = row.floorY + beginX*row.stepY;
+	unsigned int skyGroundX = (beginX+1)*row.skyGroundStep;
+	unsigned int floorColor, roofColor;
+	int floorTexture, roofTexture, texel;
+
+	for (int viewPortX=beginX;viewPortX<endX;viewPortX++) {
+		int cellX = floorX >> 16;
+		int cellY = floorY >> 16;
+
+		floorTexture = 0;
+		roofTexture = 0;
+		if (((unsigned int) cellX < (unsigned int) g_mapWidth) && ((unsigned int) cellY < (unsigned int) g_mapHeight)) {
+			floorTexture = MAPCELL(g_floorMap,cellX,cellY);
+			roofTexture = MAPCELL(g_roofMap,cellX,cellY);
 		}
-		if (texture==TEXTURECOLORLINE) { // red color line
-			red = 255-(glutGet(GLUT_ELAPSED_TIME)/10)&255;
-			green = 0;
-			blue = 0;
-			red/=darken;
-			green/=darken;
-			blue/=darken;
-			if (side) {
-				red/=2;
-				green/=2;
-				blue/=2;	
-			}
-			return true;
+		texel = (((floorY >> textureShift) & (mipSize-1)) << mipShift) + ((floorX >> textureShift) & (mipSize-1));
+
+		// Floor or ground
+		if (floorTexture > 0) {
+			if (texturedFloor) floorColor = floorTextures[((floorTexture-1) << 2*mipShift) + texel]; else floorColor = RGBA(255,0,255);
+		} else {
+			if (g_showTextures) floorColor = textures[row.groundTexel + ((g_textureSkyGroundOffsetStatic + (skyGroundX >> 16)) & textureMask)]; else floorColor = RGBA(0,255,255);
 		}
-		return false;
-	} else {
-		red/=darken;
-		green/=darken;
-		blue/=darken;
-
-		if (side) {
-			red/=2;
-			green/=2;
-			blue/=2;	
+		// Roof or sky
+		if (roofTexture > 0) {
+			if (texturedFloor) roofColor = floorTextures[((roofTexture-1) << 2*mipShift) + texel]; else roofColor = RGBA(255,255,0);
+		} else {
+			if (g_showTextures) roofColor = textures[row.skyTexel + ((g_textureSkyGroundOffsetAutoRotate + (skyGroundX >> 16)) & textureMask)]; else roofColor = RGBA(0,0,255);
 		}
-		return true; 
+		row.floorLine[viewPortX] = SHADERGBA(floorColor,row.shade);
+		row.roofLine[viewPortX] = SHADERGBA(roofColor,row.shade);
+
+		floorX += row.stepX;
+		floorY += row.stepY;
+		skyGroundX += row.skyGroundStep;
 	}
 }
 
-// Sort algorithm (sort the sprites based on distance, from https://lodev.org/cgtutor/raycasting.html, (c) 2004-2021, Lode Vandevenne)
-void sortSprites(int* order, double* dist, int amount)
-{
-	std::vector<std::pair<double, int> > sprites(amount);
-	for(int i = 0; i < amount; i++) {
-		sprites[i].first = dist[i];
-		sprites[i].second = order[i];
+#ifdef SIMDX86
+// Draw columns [beginX;endX[ of background row with 8 pixels per step (AVX2, only for all textures enabled, same results as drawBackgroundSpanScalar)
+__attribute__((target("avx2")))
+void drawBackgroundSpanAVX2(const BackgroundRow &row, int beginX, int endX) {
+	const int *textures = (const int *) &g_texturesRGBA[0][0];
+	const int *floorTextures = (const int *) &g_texturesRGBA[row.mipLevel][0];
+	const int mipShift = g_textureShift - row.mipLevel;
+	const __m256i lanes = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+	const __m256i textureMask = _mm256_set1_epi32(g_textureSize-1);
+	const __m256i mapWidth = _mm256_set1_epi32(g_mapWidth);
+	const __m256i mapHeight = _mm256_set1_epi32(g_mapHeight);
+	const __m256i cellMask = _mm256_set1_epi32(0xff);
+	const __m256i minusOne = _mm256_set1_epi32(-1);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i mipMask = _mm256_set1_epi32((1 << mipShift)-1);
+	const __m128i textureTexelsShift = _mm_cvtsi32_si128(2*mipShift);
+	const __m256i lowMask = _mm256_set1_epi32(0x00ff00ff);
+	const __m256i highMask = _mm256_set1_epi32(0xff00ff00);
+	const __m256i alpha = _mm256_set1_epi32(0xff000000);
+	const __m256i shade = _mm256_set1_epi32(row.shade);
+	const __m256i groundTexel = _mm256_set1_epi32(row.groundTexel);
+	const __m256i skyTexel = _mm256_set1_epi32(row.skyTexel);
+	const __m256i groundOffset = _mm256_set1_epi32(g_textureSkyGroundOffsetStatic);
+	const __m256i skyOffset = _mm256_set1_epi32(g_textureSkyGroundOffsetAutoRotate);
+	const __m128i textureShift = _mm_cvtsi32_si128(16 - mipShift);
+	const __m128i textureRowShift = _mm_cvtsi32_si128(mipShift);
+	const __m256i stepX8 = _mm256_set1_epi32(8*row.stepX);
+	const __m256i stepY8 = _mm256_set1_epi32(8*row.stepY);
+	const __m256i skyGroundStep8 = _mm256_set1_epi32(8*row.skyGroundStep);
+	int viewPortX = beginX;
+
+	__m256i floorX = _mm256_add_epi32(_mm256_set1_epi32(row.floorX + beginX*row.stepX),_mm256_mullo_epi32(lanes,_mm256_set1_epi32(row.stepX)));
+	__m256i floorY = _mm256_add_epi32(_mm256_set1_epi32(row.floorY + beginX*row.stepY),_mm256_mullo_epi32(lanes,_mm256_set1_epi32(row.stepY)));
+	__m256i skyGroundX = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_set1_epi32(beginX+1),lanes),_mm256_set1_epi32(row.skyGroundStep));
+
+	for (;viewPortX+8 <= endX;viewPortX+=8) {
+		__m256i cellX = _mm256_srai_epi32(floorX,16);
+		__m256i cellY = _mm256_srai_epi32(floorY,16);
+		__m256i inMap = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(cellX,minusOne),_mm256_cmpgt_epi32(mapWidth,cellX)),
+			_mm256_and_si256(_mm256_cmpgt_epi32(cellY,minusOne),_mm256_cmpgt_epi32(mapHeight,cellY)));
+		__m256i cell = _mm256_and_si256(_mm256_add_epi32(_mm256_mullo_epi32(cellY,mapWidth),cellX),inMap);
+		__m256i floorTexture = _mm256_and_si256(_mm256_mask_i32gather_epi32(zero,(const int *) g_floorMap,cell,inMap,1),cellMask);
+		__m256i roofTexture = _mm256_and_si256(_mm256_mask_i32gather_epi32(zero,(const int *) g_roofMap,cell,inMap,1),cellMask);
+		__m256i texel = _mm256_add_epi32(_mm256_sll_epi32(_mm256_and_si256(_mm256_sra_epi32(floorY,textureShift),mipMask),textureRowShift),
+			_mm256_and_si256(_mm256_sra_epi32(floorX,textureShift),mipMask));
+		__m256i skyGroundColumn = _mm256_srli_epi32(skyGroundX,16);
+
+		// Floor or ground
+		__m256i hasTexture = _mm256_cmpgt_epi32(floorTexture,zero);
+		__m256i color = _mm256_blendv_epi8(
+			_mm256_i32gather_epi32(textures,_mm256_add_epi32(groundTexel,_mm256_and_si256(_mm256_add_epi32(groundOffset,skyGroundColumn),textureMask)),4),
+			_mm256_mask_i32gather_epi32(zero,floorTextures,_mm256_add_epi32(_mm256_sll_epi32(_mm256_sub_epi32(floorTexture,_mm256_set1_epi32(1)),textureTexelsShift),texel),hasTexture,4),
+			hasTexture);
+		color = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(_mm256_mullo_epi32(_mm256_and_si256(color,lowMask),shade),8),lowMask),
+			_mm256_and_si256(_mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(color,8),lowMask),shade),highMask)),alpha);
+		_mm256_storeu_si256((__m256i *) &row.floorLine[viewPortX],color);
+
+		// Roof or sky
+		hasTexture = _mm256_cmpgt_epi32(roofTexture,zero);
+		color = _mm256_blendv_epi8(
+			_mm256_i32gather_epi32(textures,_mm256_add_epi32(skyTexel,_mm256_and_si256(_mm256_add_epi32(skyOffset,skyGroundColumn),textureMask)),4),
+			_mm256_mask_i32gather_epi32(zero,floorTextures,_mm256_add_epi32(_mm256_sll_epi32(_mm256_sub_epi32(roofTexture,_mm256_set1_epi32(1)),textureTexelsShift),texel),hasTexture,4),
+			hasTexture);
+		color = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(_mm256_mullo_epi32(_mm256_and_si256(color,lowMask),shade),8),lowMask),
+			_mm256_and_si256(_mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(color,8),lowMask),shade),highMask)),alpha);
+		_mm256_storeu_si256((__m256i *) &row.roofLine[viewPortX],color);
+
+		floorX = _mm256_add_epi32(floorX,stepX8);
+		floorY = _mm256_add_epi32(floorY,stepY8);
+		skyGroundX = _mm256_add_epi32(skyGroundX,skyGroundStep8);
 	}
-	std::sort(sprites.begin(), sprites.end());
-	// restore in reverse order to go from farthest to nearest
-	for(int i = 0; i < amount; i++) {
-		dist[i] = sprites[amount - i - 1].first;
-		order[i] = sprites[amount - i - 1].second;
+	if (viewPortX < endX) drawBackgroundSpanScalar(row,viewPortX,endX); // remaining columns
+}
+#endif
+
+// Draw floor, roof, sky and ground for rows [beginY;endY[ into CPU framebuffer (16.16 fixed point, shading per row)
+void drawBackgroundRowsFixed(int beginY, int endY) {
+	BackgroundRow row;
+
+	void (*drawSpan)(const BackgroundRow &, int, int) = (g_showTextures && g_showBackgroundTexture) ? g_drawBackgroundSpan : drawBackgroundSpanScalar;
+
+	for (int viewPortY = std::max(beginY,g_minWallCover);viewPortY < endY;viewPortY++) { // rows near the horizon can be hidden by walls
+		prepareBackgroundRow(viewPortY,row);
+		if ((viewPortY >= g_maxWallCover) && !g_frameReused) {
+			drawSpan(row,0,g_viewPort3dWidth);
+			continue;
+		}
+		// only runs of columns without a wall in front of the row (and rendered in this frame)
+		int viewPortX = 0;
+		while (viewPortX < g_viewPort3dWidth) {
+			while ((viewPortX < g_viewPort3dWidth) && ((g_wallCover[viewPortX] > viewPortY) || !g_changedColumns[viewPortX])) viewPortX++;
+			int beginX = viewPortX;
+			while ((viewPortX < g_viewPort3dWidth) && (g_wallCover[viewPortX] <= viewPortY) && g_changedColumns[viewPortX]) viewPortX++;
+			if (viewPortX > beginX) drawSpan(row,beginX,viewPortX);
+		}
 	}
 }
 
-// Draw sprites (based on https://lodev.org/cgtutor/raycasting.html, (c) 2004-2021, Lode Vandevenne)
-void drawSprites() {
-	int red, green, blue, x , y;
-		
-	for(int i = 0; i < MAXSPRITES; i++) {
-		g_spriteOrder[i] = i;
-		g_spriteDistance[i] = ((g_viewerX - g_sprites[i].x) * (g_viewerX - g_sprites[i].x) + (g_viewerY - g_sprites[i].y) * (g_viewerY - g_sprites[i].y)); //sqrt not taken, unneeded
-    }
-    
-    sortSprites(g_spriteOrder, g_spriteDistance, MAXSPRITES);
-   	for(int i = 0; i < MAXSPRITES; i++) {
-   		if (!g_sprites[g_spriteOrder[i]].collected && ((g_sprites[g_spriteOrder[i]].type & SPRITECOLLECTION) == SPRITECOLLECTION)) {
-   			// hide collectable sprite when reached
-	   		if (((int)g_sprites[g_spriteOrder[i]].x == (int) g_viewerX) && ((int)g_sprites[g_spriteOrder[i]].y==(int) g_viewerY)) {
-				g_sprites[g_spriteOrder[i]].collected = true;
-				if ((g_sprites[g_spriteOrder[i]].type & SPRITEOPENER) == SPRITEOPENER) { // sprite to open a wall
-					x = g_sprites[g_spriteOrder[i]].openX;
-					y = g_sprites[g_spriteOrder[i]].openY;
-					// change floor texture near open wall
-					if (y > 0) g_floorMap[y-1][x] = TEXTUREROUGHWALL+1; 
-					if (y < MAPHEIGHT-1) g_floorMap[y+1][x] = TEXTUREROUGHWALL+1;
-					if (x > 0) g_floorMap[y][x-1] = TEXTUREROUGHWALL+1; 
-					if (x < MAPWIDTH-1) g_floorMap[y][x+1] = TEXTUREROUGHWALL+1; 
-					g_wallMap[y][x] = 0; // open wall
-										
-					g_stateStartTime = glutGet(GLUT_ELAPSED_TIME);
-					snprintf(g_displayText,DISPLAYTEXTMAXLENGTH+1,"Wall open");
-	    			g_displayTextBlinking = false;					
-				}
-				continue;
-			}
+// Texture offsets for sky and ground by viewer rotation and time
+void prepareSkyOffsets() {
+	static GLint autoSkyRotateTime = 0;
+	static int autoSkyRotate = 0;
 
-			//translate sprite position to relative to camera
-			double spriteX = g_sprites[g_spriteOrder[i]].x - g_viewerX;
-			double spriteY = g_sprites[g_spriteOrder[i]].y - g_viewerY;
-			
-			//transform sprite with the inverse camera matrix
-			// [ planeX   dirX ] -1                                       [ dirY      -dirX ]
-			// [               ]       =  1/(planeX*dirY-dirX*planeY) *   [                 ]
-			// [ planeY   dirY ]                                          [ -planeY  planeX ]
-					
-			double invDet = 1.0 / (g_cachedCos90 * g_cachedSin - g_cachedCos * g_cachedSin90); //required for correct matrix multiplication
-			
-			double transformX = invDet * (g_cachedSin * spriteX - g_cachedCos * spriteY);
-			double transformY = invDet * (-g_cachedSin90 * spriteX + g_cachedCos90 * spriteY); //this is actually the depth inside the screen, that what Z is in 3D
-			
-			int spriteScreenX = int((g_viewPort3dWidth / 2) * (1 + transformX / transformY));	
-			
-			//calculate height of the sprite on screen
-			int spriteHeight = abs(int(g_viewPort3dHeight / (transformY))); //using 'transformY' instead of the real distance prevents fisheye
-			//calculate lowest and highest pixel to fill in current stripe
-			int drawStartY = -spriteHeight / 2 + g_viewPort3dHeight / 2;
-			if(drawStartY < 0) drawStartY = 0;
-			int drawEndY = spriteHeight / 2 + g_viewPort3dHeight / 2;
-			if(drawEndY >= g_viewPort3dHeight) drawEndY = g_viewPort3dHeight - 1;
-			
-			//calculate width of the sprite
-			int spriteWidth = spriteHeight;
-			int drawStartX = -spriteWidth / 2 + spriteScreenX;
-			if(drawStartX < 0) drawStartX = 0;
-			int drawEndX = spriteWidth / 2 + spriteScreenX;
-			if(drawEndX >= g_viewPort3dWidth) drawEndX = g_viewPort3dWidth - 1;
-			
-			//loop through every vertical stripe of the sprite on screen
-			for(int stripe = drawStartX; stripe < drawEndX; stripe++) {
-				int texX = int(256 * (stripe - (-spriteWidth / 2 + spriteScreenX)) * TEXTURESIZE / spriteWidth) / 256;
-				//the conditions in the if are:
-				//1) it's in front of camera plane so you don't see things behind you
-				//2) it's on the screen (left)
-				//3) it's on the screen (right)
-				//4) g_zBuffer, with perpendicular distance
+	if (getElapsedTime() - autoSkyRotateTime > SKYROTATEINTERVAL) { // move sky every 100 ms one texture pixel
+		autoSkyRotate++;
+		autoSkyRotateTime=getElapsedTime();
+	}
+	requestImageChange(autoSkyRotateTime+SKYROTATEINTERVAL+1);
+
+	int textureSkyGroundOffsetViewer = (float) (6*SKYSCALE*g_textureSize*g_viewerAngle/360); // texture offset for ground and sky, dependent on viewer rotation	
+	g_textureSkyGroundOffsetAutoRotate = (autoSkyRotate+ textureSkyGroundOffsetViewer/SKYSCALE)%g_textureSize; // texture pixel offset for ground and sky, dependent on viewer rotation and time
+	g_textureSkyGroundOffsetStatic = (textureSkyGroundOffsetViewer/SKYSCALE)%g_textureSize; // texture pixel offset for ground and sky, dependent on viewer rotation
+}
+
+// Draw sky, ground, floor and roof (floor and roof based on https://lodev.org/cgtutor/raycasting.html, (c) 2004-2021, Lode Vandevenne)
+void drawBackground() {
 	
-				if(transformY > 0 && stripe > 0 && stripe < g_viewPort3dWidth && transformY < g_zBuffer[stripe]) {
-					for(int y = drawStartY; y < drawEndY; y++) { //for every pixel of the current stripe
-						int d = (y) * 256 - g_viewPort3dHeight * 128 + spriteHeight * 128; //256 and 128 factors to avoid floats
-						int texY = ((d * TEXTURESIZE) / spriteHeight) / 256;
-						glPointSize(g_pixelSize);
-						glBegin(GL_POINTS);
-						if (getTextureColor(g_sprites[g_spriteOrder[i]].texture,false, (TEXTURESIZE * texY + texX)*3, 1, red, green, blue)) {
-							glColor3ub(red,green,blue); 
-							glVertex2i(g_viewPort3dOffsetX + stripe*g_pixelSize+g_pixelOffset,y*g_pixelSize+g_pixelOffset);
-						}
-						glEnd();
-					}  
+	if (!g_showBackground) { // draw floor if background is not disabled
+		
+		if (g_useFrameBuffer) { // floor plane in CPU framebuffer
+			fillFrameBufferRows(g_viewPort3dHalfHeight,g_viewPort3dHeight,RGBA(102,102,102));
+		} else if (!g_roundPixels) { // quad pixels
+			// floor plane
+			glLineWidth(1);
+			glColor3f(0.4,0.4,0.4);
+			glBegin(GL_QUADS);
+			glVertex2i(g_viewPort3dOffsetX,g_pixelSize*g_viewPort3dHeight/2);
+			glVertex2i(g_viewPort3dOffsetX+g_pixelSize*g_viewPort3dWidth,g_pixelSize*g_viewPort3dHeight/2);
+			glVertex2i(g_viewPort3dOffsetX+g_pixelSize*g_viewPort3dWidth,g_pixelSize*g_viewPort3dHeight-1);
+			glVertex2i(g_viewPort3dOffsetX,g_pixelSize*g_viewPort3dHeight-1);
+			glEnd();
+		} else { // round pixels
+			glPointSize(g_pixelSize);
+			glColor3f(0.4,0.4,0.4);
+
+			glBegin(GL_POINTS);
+
+	      	for (int viewPortX=0;viewPortX<g_viewPort3dWidth;viewPortX++) {
+   		      	for (int viewPortY=0;viewPortY<g_viewPort3dHalfHeight;viewPortY++) {
+					glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHalfHeight)*g_pixelSize+viewPortY*g_pixelSize+g_pixelOffset);
 				}
 			}
-		}
+			glEnd();
+		}	
 	}
-}
-
-// Raycaster via DDA (based on https://lodev.org/cgtutor/raycasting.html, (c) 2004-2021, Lode Vandevenne)
-void drawRaycastDDA() {
-	int red,green,blue;
-	float darken;
-	bool offMap;
 	
-	//WALL CASTING
-    for(int x = 0; x < g_viewPort3dWidth; x++) {    	
-		//calculate ray position and direction
-		double cameraX = 2 * x / double(g_viewPort3dWidth) - 1; //x-coordinate in camera space
-		double rayDirX = (g_cachedCos + g_cachedCos90 * cameraX);
-		double rayDirY = (g_cachedSin + g_cachedSin90 * cameraX);
+	if (g_engine == ENGINEOLD) return; // old style raycaster makes sky by himself
 	
-		//which box of the map we're in
-		int mapX = int(g_viewerX);
-		int mapY = int(g_viewerY);
-		
-		//length of ray from current position to next x or y-side
-		double sideDistX;
-		double sideDistY;
+	if (!g_showBackground) return;
+
+	prepareSkyOffsets();
+	if (g_useFrameBuffer) {
+		parallelFor(g_viewPort3dHalfHeight,drawBackgroundRowsFixed); // rows in bands on all threads
+	} else {
+		beginPixels();
+		drawBackgroundRows(0,g_viewPort3dHalfHeight);
+		endPixels();
+	}
+}
+
+// Get RGB for packed texture pixel, darkened by light table
+bool getTextureColor(int texture, unsigned int texel, const unsigned char *light, int &red, int &green, int &blue) {
+	if (texel == TRANSPARENTTEXEL) { // special color
+		texel = g_animatedTexels[texture];
+		if (texel == 0) return false;
+		if (!g_animatedTexelsDrawn.load(std::memory_order_relaxed)) g_animatedTexelsDrawn.store(true,std::memory_order_relaxed);
+	}
+	red = light[texel & 0xff];
+	green = light[(texel >> 8) & 0xff];
+	blue = light[(texel >> 16) & 0xff];
+	return true; 
+}
+
+// Sort sprites from farthest to nearest by ascending key (stable, insertion sort for few sprites, else radix sort with 8 bits per pass)
+void sortSprites(int amount)
+{
+	int *order = g_spriteOrder.data();
+	unsigned int *key = g_spriteDistance.data();
+
+	if (amount < SPRITEINSERTIONSORT) {
+		for (int i = 1; i < amount; i++) {
+			int sprite = order[i];
+			unsigned int spriteKey = key[i];
+			int j = i;
+			for (; (j > 0) && (key[j-1] > spriteKey); j--) {
+				order[j] = order[j-1];
+				key[j] = key[j-1];
+			}
+			order[j] = sprite;
+			key[j] = spriteKey;
+		}
+		return;
+	}
+
+	int *orderTemp = g_spriteOrderTemp.data();
+	unsigned int *keyTemp = g_spriteDistanceTemp.data();
+	for (int shift = 0; shift < 32; shift += 8) {
+		int count[257] = { 0 };
+		for (int i = 0; i < amount; i++) count[((key[i] >> shift) & 0xff)+1]++;
+		if (count[((key[0] >> shift) & 0xff)+1] == amount) continue; // all keys have same byte
+		for (int i = 1; i < 256; i++) count[i] += count[i-1];
+		for (int i = 0; i < amount; i++) {
+			int target = count[(key[i] >> shift) & 0xff]++;
+			orderTemp[target] = order[i];
+			keyTemp[target] = key[i];
+		}
+		std::swap(order,orderTemp);
+		std::swap(key,keyTemp);
+	}
+	if (order != g_spriteOrder.data()) { // result in temporary buffers
+		memcpy(g_spriteOrder.data(),order,amount*sizeof(int));
+	}
+}
+
+// Put sprites into uniform grid over map cells (sprites outside the map into nearest border cell)
+void buildSpriteGrid() {
+	std::vector<int> cells(g_sprites.size());
+
+	for (g_spriteGridShift = 0; ((g_mapWidth-1) >> g_spriteGridShift) >= SPRITEGRIDMAX || ((g_mapHeight-1) >> g_spriteGridShift) >= SPRITEGRIDMAX; g_spriteGridShift++);
+	g_spriteGridWidth = ((g_mapWidth-1) >> g_spriteGridShift)+1;
+	g_spriteGridHeight = ((g_mapHeight-1) >> g_spriteGridShift)+1;
+	int cellCount = g_spriteGridWidth*g_spriteGridHeight;
+
+	g_spriteGridStart.assign(cellCount+1,0);
+	for (size_t i = 0; i < g_sprites.size(); i++) {
+		int cellX = std::min(std::max((int) g_sprites[i].x,0),g_mapWidth-1) >> g_spriteGridShift;
+		int cellY = std::min(std::max((int) g_sprites[i].y,0),g_mapHeight-1) >> g_spriteGridShift;
+		cells[i] = cellY*g_spriteGridWidth+cellX;
+		g_spriteGridStart[cells[i]+1]++;
+	}
+	for (int cell = 0; cell < cellCount; cell++) g_spriteGridStart[cell+1] += g_spriteGridStart[cell];
+	g_spriteGrid.resize(g_sprites.size());
+	std::vector<int> next(g_spriteGridStart.begin(),g_spriteGridStart.end()-1);
+	for (size_t i = 0; i < g_sprites.size(); i++) g_spriteGrid[next[cells[i]]++] = i;
+
+	g_spriteOrder.resize(g_sprites.size());
+	g_spriteOrderTemp.resize(g_sprites.size());
+	g_spriteDistance.resize(g_sprites.size());
+	g_spriteDistanceTemp.resize(g_sprites.size());
+	g_spriteProjections.resize(g_sprites.size());
+}
+
+// Texture row of sprite of height spriteHeight for screen row y
+inline int spriteTextureY(int y, int spriteHeight) {
+	long long d = (y) * 256 - g_viewPort3dHeight * 128 + spriteHeight * 128LL; //256 and 128 factors to avoid floats, 64 bit for large textures and near sprites
+	return (int) (((d * g_textureSize) / spriteHeight) / 256);
+}
+
+// Draw projected sprites for screen columns [beginX;endX[ (based on https://lodev.org/cgtutor/raycasting.html, (c) 2004-2021, Lode Vandevenne)
+void drawSpriteColumns(int beginX, int endX) {
+	TextureSpan fullSpan = { 0, (unsigned short) g_textureSize };
+
+	for (int i = 0; i < g_spriteProjectionCount; i++) { // from farthest to nearest
+		SpriteProjection &sprite = g_spriteProjections[i];
+		int spriteWidth = sprite.height;
+		int drawStartX = std::max(sprite.drawStartX,beginX);
+		int drawEndX = std::min(sprite.drawEndX,endX);
+		unsigned int animatedTexel = g_animatedTexels[sprite.texture];
+
+		//loop through every vertical stripe of the sprite on screen
+		for(int stripe = drawStartX; stripe < drawEndX; stripe++) {
+			int texX = int(256LL * (stripe - (-spriteWidth / 2 + sprite.screenX)) * g_textureSize / spriteWidth) / 256; // 64 bit for large textures and near sprites
+			const unsigned int *textureColumn = TEXTURECOLUMN(sprite.texture,texX);
+			//the conditions in the if are:
+			//1) it's in front of camera plane so you don't see things behind you
+			//2) it's on the screen (left)
+			//3) it's on the screen (right)
+			//4) g_zBuffer, with perpendicular distance
+
+			if(sprite.transformY > 0 && stripe > 0 && stripe < g_viewPort3dWidth && sprite.transformY < g_zBuffer[stripe]) {
+				// opaque spans of texture column (whole column, when special texels are animated in this frame)
+				const TextureSpan *span = &g_textureSpans[0] + g_textureColumnSpans[sprite.texture*g_textureSize+texX];
+				const TextureSpan *spanEnd = &g_textureSpans[0] + g_textureColumnSpans[sprite.texture*g_textureSize+texX+1];
+				if (animatedTexel != 0) {
+					g_animatedColumns[stripe] = 1;
+					span = &fullSpan;
+					spanEnd = span+1;
+					if (!g_animatedTexelsDrawn.load(std::memory_order_relaxed)) g_animatedTexelsDrawn.store(true,std::memory_order_relaxed);
+				}
+				int y = sprite.drawStartY;
+				beginPixels();
+				for (;span < spanEnd;span++) {
+					// first screen row of span
+					while ((y < sprite.drawEndY) && (spriteTextureY(y,sprite.height) < span->begin)) y++;
+					for (;(y < sprite.drawEndY);y++) { // every pixel of span
+						int texY = spriteTextureY(y,sprite.height);
+						if (texY >= span->end) break;
+						unsigned int texel = textureColumn[texY];
+						if (texel == TRANSPARENTTEXEL) texel = animatedTexel;
+						if (g_useFrameBuffer) g_frameBuffer[y*g_viewPort3dWidth+stripe] = texel;
+						else drawPixel(stripe,y,texel & 0xff,(texel >> 8) & 0xff,(texel >> 16) & 0xff);
+					}
+				}
+				endPixels();
+			}
+		}
+	}
+}
+
+// Set or clear solid cell in bitmap (x,y within map or sentinel border)
+void setSolid(int x, int y, bool solid) {
+	unsigned long long &tile = g_solidTiles[SOLIDTILE(x+1,y+1)];
+	unsigned long long bit = 1ULL << SOLIDBIT(x+1,y+1);
+	if (solid) tile |= bit; else tile &= ~bit;
+
+	// update tile bit in block (local update, no rebuild of the coarse level)
+	unsigned long long &block = g_solidBlocks[SOLIDBLOCK(x+1,y+1)];
+	unsigned long long tileBit = 1ULL << SOLIDBIT((x+1) >> 3,(y+1) >> 3);
+	if (tile != 0) block |= tileBit; else block &= ~tileBit;
+}
+
+// Build solid cell bitmap from wall map with sentinel border
+void buildSolidGrid() {
+	g_solidTilesPerRow = (g_mapWidth+2+7) >> 3;
+	g_solidTiles.assign((size_t) g_solidTilesPerRow*((g_mapHeight+2+7) >> 3),0);
+	g_solidBlocksPerRow = (g_mapWidth+2+63) >> 6;
+	g_solidBlocks.assign((size_t) g_solidBlocksPerRow*((g_mapHeight+2+63) >> 6),0);
+	for (int y=-1;y<=g_mapHeight;y++) {
+		bool border = (y < 0) || (y == g_mapHeight);
+		for (int x=-1;x<=g_mapWidth;x++) {
+			if (border || (x < 0) || (x == g_mapWidth) || (MAPCELL(g_wallMap,x,y) > 0)) setSolid(x,y,true);
+		}
+	}
+}
+
+// Collect collectable sprites in map cell of viewer
+void collectSprites() {
+	if (!ISGRIDINMAP(g_viewerX,g_viewerY)) return;
+	int cell = ((int) g_viewerY >> g_spriteGridShift)*g_spriteGridWidth + ((int) g_viewerX >> g_spriteGridShift);
+
+	for (int k = g_spriteGridStart[cell]; k < g_spriteGridStart[cell+1]; k++) {
+		Sprite &sprite = g_sprites[g_spriteGrid[k]];
+		if (sprite.collected || ((sprite.type & SPRITECOLLECTION) != SPRITECOLLECTION)) continue;
+		if (((int)sprite.x != (int) g_viewerX) || ((int)sprite.y != (int) g_viewerY)) continue; // other map cell of grid cell
+		sprite.collected = true;
+		g_sceneChanges++;
+		if ((sprite.type & SPRITEOPENER) == SPRITEOPENER) { // sprite to open a wall
+			int x = sprite.openX;
+			int y = sprite.openY;
+			// change floor texture near open wall
+			if (y > 0) MAPCELL(g_floorMap,x,y-1) = TEXTUREROUGHWALL+1; 
+			if (y < g_mapHeight-1) MAPCELL(g_floorMap,x,y+1) = TEXTUREROUGHWALL+1;
+			if (x > 0) MAPCELL(g_floorMap,x-1,y) = TEXTUREROUGHWALL+1; 
+			if (x < g_mapWidth-1) MAPCELL(g_floorMap,x+1,y) = TEXTUREROUGHWALL+1; 
+			MAPCELL(g_wallMap,x,y) = 0; // open wall
+			setSolid(x,y,false);
+								
+			g_stateStartTime = g_simulationTime;
+			snprintf(g_displayText,DISPLAYTEXTMAXLENGTH+1,"Wall open");
+			g_displayTextBlinking = false;					
+		}
+	}
+}
+
+// Draw sprites (based on https://lodev.org/cgtutor/raycasting.html, (c) 2004-2021, Lode Vandevenne)
+void drawSprites() {
+	int visibleSprites = 0;
+
+	//transform with the inverse camera matrix
+	// [ planeX   dirX ] -1                                       [ dirY      -dirX ]
+	// [               ]       =  1/(planeX*dirY-dirX*planeY) *   [                 ]
+	// [ planeY   dirY ]                                          [ -planeY  planeX ]
+	double invDet = 1.0 / (g_cachedCos90 * g_cachedSin - g_cachedCos * g_cachedSin90); //required for correct matrix multiplication
+
+	// frustum culling of grid cells (cell enlarged by half sprite width), then of single sprites
+	int gridCellSize = 1 << g_spriteGridShift;
+	for (int cellY = 0; cellY < g_spriteGridHeight; cellY++) {
+		for (int cellX = 0; cellX < g_spriteGridWidth; cellX++) {
+			int cell = cellY*g_spriteGridWidth+cellX;
+			if (g_spriteGridStart[cell] == g_spriteGridStart[cell+1]) continue;
+
+			bool behind = true, left = true, right = true;
+			for (int corner = 0; corner < 4; corner++) {
+				double cornerX = (cellX + (corner & 1))*gridCellSize - 0.5 + (corner & 1) - g_viewerX;
+				double cornerY = (cellY + (corner >> 1))*gridCellSize - 0.5 + (corner >> 1) - g_viewerY;
+				double transformX = invDet * (g_cachedSin * cornerX - g_cachedCos * cornerY);
+				double transformY = invDet * (-g_cachedSin90 * cornerX + g_cachedCos90 * cornerY);
+				if (transformY > 0) behind = false;
+				if (transformX >= -transformY) left = false;
+				if (transformX <= transformY) right = false;
+			}
+			if (behind || left || right) continue;
+
+			for (int k = g_spriteGridStart[cell]; k < g_spriteGridStart[cell+1]; k++) {
+				int i = g_spriteGrid[k];
+				if (g_sprites[i].collected) continue;
+
+				//translate sprite position to relative to camera
+				double spriteX = g_sprites[i].x - g_viewerX;
+				double spriteY = g_sprites[i].y - g_viewerY;
+				double transformY = invDet * (-g_cachedSin90 * spriteX + g_cachedCos90 * spriteY);
+				if (transformY <= 0) continue; // behind camera plane
+				
+				float distance = spriteX * spriteX + spriteY * spriteY; //sqrt not taken, unneeded
+				unsigned int distanceBits;
+				memcpy(&distanceBits,&distance,sizeof(distanceBits));
+				g_spriteOrder[visibleSprites] = i;
+				g_spriteDistance[visibleSprites] = ~distanceBits; // positive floats sort like their bits
+				visibleSprites++;
+			}
+		}
+	}
+    
+	sortSprites(visibleSprites);
+
+	g_spriteProjectionCount = 0;
+   	for(int n = 0; n < visibleSprites; n++) {
+		Sprite &sprite = g_sprites[g_spriteOrder[n]];
+
+		//translate sprite position to relative to camera
+		double spriteX = sprite.x - g_viewerX;
+		double spriteY = sprite.y - g_viewerY;
 		
-		//length of ray from one x or y-side to next x or y-side
-		double deltaDistX = (rayDirX == 0) ? 1e30 : myAbs(1 / rayDirX);
-		double deltaDistY = (rayDirY == 0) ? 1e30 : myAbs(1 / rayDirY);
-		double perpWallDist;
-	  	
-		//what direction to step in x or y-direction (either +1 or -1)
-		int stepX;
-		int stepY;
+		double transformX = invDet * (g_cachedSin * spriteX - g_cachedCos * spriteY);
+		double transformY = invDet * (-g_cachedSin90 * spriteX + g_cachedCos90 * spriteY); //this is actually the depth inside the screen, that what Z is in 3D
 		
-		int hit = 0; //was there a wall hit?
-		int side; //was a NS or a EW wall hit?
+		int spriteScreenX = int((g_viewPort3dWidth / 2) * (1 + transformX / transformY));	
 		
-		//calculate step and initial sideDist
-		if (rayDirX < 0) {
-			stepX = -1;
-			sideDistX = (g_viewerX - mapX) * deltaDistX;
-		} else {
-			stepX = 1;
-			sideDistX = (mapX + 1.0 - g_viewerX) * deltaDistX;
-		}
-		if (rayDirY < 0) {
-			stepY = -1;
-			sideDistY = (g_viewerY - mapY) * deltaDistY;
-		} else {
-			stepY = 1;
-			sideDistY = (mapY + 1.0 - g_viewerY) * deltaDistY;
-		}
+		//calculate height of the sprite on screen
+		int spriteHeight = abs(int(g_viewPort3dHeight / (transformY))); //using 'transformY' instead of the real distance prevents fisheye
+		if (spriteHeight == 0) continue; // too far away
+		//calculate lowest and highest pixel to fill in current stripe
+		int drawStartY = -spriteHeight / 2 + g_viewPort3dHeight / 2;
+		if(drawStartY < 0) drawStartY = 0;
+		int drawEndY = spriteHeight / 2 + g_viewPort3dHeight / 2;
+		if(drawEndY >= g_viewPort3dHeight) drawEndY = g_viewPort3dHeight - 1;
 		
-		//perform DDA
-	  	offMap = false;
-		while (hit == 0) {
-			//jump to next map square, either in x-direction, or in y-direction
-			if (sideDistX < sideDistY) {
-				sideDistX += deltaDistX;
-				mapX += stepX;
-				side = 0;
+		//calculate width of the sprite
+		int spriteWidth = spriteHeight;
+		int drawStartX = -spriteWidth / 2 + spriteScreenX;
+		if(drawStartX < 0) drawStartX = 0;
+		int drawEndX = spriteWidth / 2 + spriteScreenX;
+		if(drawEndX >= g_viewPort3dWidth) drawEndX = g_viewPort3dWidth - 1;
+		if (drawStartX >= drawEndX) continue; // outside of screen
+
+		// remember projection for drawing the columns
+		SpriteProjection &projection = g_spriteProjections[g_spriteProjectionCount++];
+		projection.texture = sprite.texture;
+		projection.transformY = transformY;
+		projection.screenX = spriteScreenX;
+		projection.height = spriteHeight;
+		projection.drawStartX = drawStartX;
+		projection.drawEndX = drawEndX;
+		projection.drawStartY = drawStartY;
+		projection.drawEndY = drawEndY;
+	}
+
+	if (g_useFrameBuffer) {
+		parallelFor(g_viewPort3dWidth,drawSpriteColumns); // columns in bands on all threads
+	} else drawSpriteColumns(0,g_viewPort3dWidth);
+}
+
+// Start values of DDA ray for screen column x (based on https://lodev.org/cgtutor/raycasting.html, (c) 2004-2021, Lode Vandevenne)
+inline void prepareRayDDA(int x, RayHit &hit, double &sideDistX, double &sideDistY, double &deltaDistX, double &deltaDistY, int &stepX, int &stepY) {
+	//calculate ray position and direction
+	double cameraX = 2 * x / double(g_viewPort3dWidth) - 1; //x-coordinate in camera space
+	hit.rayDirX = (g_cachedCos + g_cachedCos90 * cameraX);
+	hit.rayDirY = (g_cachedSin + g_cachedSin90 * cameraX);
+
+	//which box of the map we're in
+	hit.mapX = int(g_viewerX);
+	hit.mapY = int(g_viewerY);
+
+	//length of ray from one x or y-side to next x or y-side
+	deltaDistX = (hit.rayDirX == 0) ? 1e30 : myAbs(1 / hit.rayDirX);
+	deltaDistY = (hit.rayDirY == 0) ? 1e30 : myAbs(1 / hit.rayDirY);
+
+	//calculate step and initial sideDist
+	if (hit.rayDirX < 0) {
+		stepX = -1;
+		sideDistX = (g_viewerX - hit.mapX) * deltaDistX;
+	} else {
+		stepX = 1;
+		sideDistX = (hit.mapX + 1.0 - g_viewerX) * deltaDistX;
+	}
+	if (hit.rayDirY < 0) {
+		stepY = -1;
+		sideDistY = (g_viewerY - hit.mapY) * deltaDistY;
+	} else {
+		stepY = 1;
+		sideDistY = (hit.mapY + 1.0 - g_viewerY) * deltaDistY;
+	}
+}
+
+// Number of DDA steps (at most maxSteps) of an axis with side distances sideDist+i*deltaDist, which come before side distance limit
+// (inclusive = steps with side distance equal to limit come before). Estimated by invDeltaDist = 1/deltaDist, which is off by at most one step.
+inline int stepsBefore(double sideDist, double deltaDist, double invDeltaDist, int maxSteps, double limit, bool inclusive) {
+	double estimate = (limit - sideDist)*invDeltaDist + 1;
+	int k = (estimate <= 0) ? 0 : (estimate >= maxSteps) ? maxSteps : (int) estimate;
+	double lastDist = sideDist + (k-1)*deltaDist; // side distance of last step before limit
+	double nextDist = sideDist + k*deltaDist; // side distance of first step after limit
+	if ((k > 0) && (inclusive ? lastDist > limit : lastDist >= limit)) k--;
+	else if ((k < maxSteps) && (inclusive ? nextDist <= limit : nextDist < limit)) k++;
+	return k;
+}
+
+// Cast DDA rays for screen columns [beginX;endX[ one by one
+// Empty tiles and blocks of the solid cell bitmap are crossed by a DDA on tile or block level. The side distance of the i-th step in a direction
+// is sideDist + i*deltaDist (not summed up step by step), so the map square where the ray enters a non-empty area is the same as by single steps.
+void castRaysDDAScalar(int beginX, int endX, RayHit *hits) {
+	double sideDistX, sideDistY, deltaDistX, deltaDistY;
+	int stepX, stepY;
+	bool viewerInMap = ISGRIDINMAP(g_viewerX,g_viewerY); // sentinel border stops only rays starting in map
+
+	for (int x = beginX; x < endX; x++) {
+		RayHit &hit = hits[x-beginX];
+		prepareRayDDA(x,hit,sideDistX,sideDistY,deltaDistX,deltaDistY,stepX,stepY);
+
+		//perform DDA (in local variables, stores to hit would reload the bitmap globals)
+		int startX = hit.mapX+1, startY = hit.mapY+1; // map square of viewer in bitmap
+		int cellX = startX, cellY = startY, side;
+		int countX = 0, countY = 0; // steps done in x and y direction
+		double nextDistX = sideDistX, nextDistY = sideDistY; // side distances of next steps
+		unsigned long long tile = viewerInMap ? g_solidTiles[SOLIDTILE(cellX,cellY)] : 1; // tile of map square (0 = empty tile)
+		while (true) {
+			if (tile != 0) {
+				//jump to next map square, either in x-direction, or in y-direction
+				if (nextDistX < nextDistY) {
+					countX++;
+					cellX += stepX;
+					nextDistX = sideDistX + countX*deltaDistX;
+					side = 0;
+				} else {
+					countY++;
+					cellY += stepY;
+					nextDistY = sideDistY + countY*deltaDistY;
+					side = 1;
+				}
 			} else {
-				sideDistY += deltaDistY;
-				mapY += stepY;
-				side = 1;
+				//cross empty blocks (64x64 squares) or tiles (8x8 squares), until the ray enters a non-empty one
+				int shift = 3;
+				if (g_solidBlocks[SOLIDBLOCK(cellX,cellY)] == 0) shift = 6;
+				int size = 1 << shift;
+				int areaX = cellX >> shift, areaY = cellY >> shift;
+				int exitX = countX + ((stepX > 0) ? size - (cellX & (size-1)) : (cellX & (size-1)) + 1) - 1; // step leaving area in x direction
+				int exitY = countY + ((stepY > 0) ? size - (cellY & (size-1)) : (cellY & (size-1)) + 1) - 1; // step leaving area in y direction
+				double exitDistX = sideDistX + exitX*deltaDistX;
+				double exitDistY = sideDistY + exitY*deltaDistY;
+				while (true) {
+					if (exitDistX < exitDistY) {
+						areaX += stepX;
+						side = 0;
+					} else {
+						areaY += stepY;
+						side = 1;
+					}
+					if ((shift == 6) ? g_solidBlocks[areaY*g_solidBlocksPerRow + areaX] != 0 : g_solidTiles[areaY*g_solidTilesPerRow + areaX] != 0) break;
+					if (side == 0) exitDistX = sideDistX + (exitX += size)*deltaDistX;
+					else exitDistY = sideDistY + (exitY += size)*deltaDistY;
+				}
+				//map square where the ray enters the non-empty area
+				if (side == 0) {
+					countX = exitX+1;
+					countY = stepsBefore(sideDistY,deltaDistY,myAbs(hit.rayDirY),exitY,exitDistX,true);
+				} else {
+					countY = exitY+1;
+					countX = stepsBefore(sideDistX,deltaDistX,myAbs(hit.rayDirX),exitX,exitDistY,false);
+				}
+				cellX = startX + stepX*countX;
+				cellY = startY + stepY*countY;
+				nextDistX = sideDistX + countX*deltaDistX;
+				nextDistY = sideDistY + countY*deltaDistY;
 			}
-	    	//Check if ray has hit a wall	
-	    	offMap = !ISGRIDINMAP(mapX,mapY);
-	    	if (offMap || g_wallMap[mapY][mapX] > 0) hit = 1;
+	    	//Check if ray has hit a wall (or sentinel border)
+	    	if (!viewerInMap) break;
+	    	tile = g_solidTiles[SOLIDTILE(cellX,cellY)];
+	    	if ((tile >> SOLIDBIT(cellX,cellY)) & 1) break;
 	  	}
-	
+	  	hit.mapX = cellX-1;
+	  	hit.mapY = cellY-1;
+	  	hit.side = side;
+	  	hit.offMap = !ISGRIDINMAP(hit.mapX,hit.mapY);
+
 		//Calculate distance of perpendicular ray (Euclidean distance would give fisheye effect!)
-		if(side == 0) perpWallDist = (sideDistX - deltaDistX);
-		else          perpWallDist = (sideDistY - deltaDistY);
+		if(hit.side == 0) hit.perpWallDist = sideDistX + (countX-1)*deltaDistX;
+		else              hit.perpWallDist = sideDistY + (countY-1)*deltaDistY;
+	}
+}
+
+#ifdef SIMDX86
+// Blend for SSE2 (no blendv): lanes of b where mask is set, else lanes of a
+__attribute__((target("sse2")))
+inline __m128d selectSSE2(__m128d a, __m128d b, __m128d mask) {
+	return _mm_or_pd(_mm_and_pd(mask,b),_mm_andnot_pd(mask,a));
+}
+
+// stepsBefore for 2 lanes (SSE2)
+__attribute__((target("sse2")))
+inline __m128d stepsBeforeSSE2(__m128d sideDist, __m128d deltaDist, __m128d invDeltaDist, __m128d maxSteps, __m128d limit, bool inclusive) {
+	const __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1);
+	__m128d estimate = _mm_min_pd(_mm_max_pd(_mm_add_pd(_mm_mul_pd(_mm_sub_pd(limit,sideDist),invDeltaDist),one),zero),maxSteps);
+	__m128d k = _mm_cvtepi32_pd(_mm_cvttpd_epi32(estimate));
+	__m128d lastDist = _mm_add_pd(sideDist,_mm_mul_pd(_mm_sub_pd(k,one),deltaDist));
+	__m128d nextDist = _mm_add_pd(sideDist,_mm_mul_pd(k,deltaDist));
+	__m128d down = _mm_and_pd(_mm_cmpgt_pd(k,zero),inclusive ? _mm_cmpgt_pd(lastDist,limit) : _mm_cmpge_pd(lastDist,limit));
+	__m128d up = _mm_andnot_pd(down,_mm_and_pd(_mm_cmplt_pd(k,maxSteps),inclusive ? _mm_cmple_pd(nextDist,limit) : _mm_cmplt_pd(nextDist,limit)));
+	return _mm_add_pd(_mm_sub_pd(k,_mm_and_pd(down,one)),_mm_and_pd(up,one));
+}
+
+// Cast DDA rays for screen columns [beginX;endX[ as packets of 2 adjacent rays (SSE2). Same double precision steps as castRaysDDAScalar, so the hits are identical.
+// Every lane does one single step or one step over an empty block or tile per iteration.
+__attribute__((target("sse2")))
+void castRaysDDASSE2(int beginX, int endX, RayHit *hits) {
+	double sideDistX[2], sideDistY[2], deltaDistX[2], deltaDistY[2], invDeltaDistX[2], invDeltaDistY[2], cellX[2], cellY[2], stepX[2], stepY[2];
+	double countX[2], countY[2], size[2], areaX[2], areaY[2];
+	int intStepX, intStepY;
+	int x;
+	const __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1);
+	const __m128d allBits = _mm_castsi128_pd(_mm_set1_epi32(-1));
+
+	if (!ISGRIDINMAP(g_viewerX,g_viewerY)) { // no sentinel border around viewer
+		castRaysDDAScalar(beginX,endX,hits);
+		return;
+	}
+	for (x = beginX; x+2 <= endX; x+=2) {
+		for (int lane=0;lane<2;lane++) {
+			RayHit &hit = hits[x-beginX+lane];
+			prepareRayDDA(x+lane,hit,sideDistX[lane],sideDistY[lane],deltaDistX[lane],deltaDistY[lane],intStepX,intStepY);
+			invDeltaDistX[lane] = myAbs(hit.rayDirX);
+			invDeltaDistY[lane] = myAbs(hit.rayDirY);
+			cellX[lane] = hit.mapX+1;
+			cellY[lane] = hit.mapY+1;
+			stepX[lane] = intStepX;
+			stepY[lane] = intStepY;
+		}
+		__m128d vSideDistX = _mm_loadu_pd(sideDistX), vSideDistY = _mm_loadu_pd(sideDistY);
+		__m128d vDeltaDistX = _mm_loadu_pd(deltaDistX), vDeltaDistY = _mm_loadu_pd(deltaDistY);
+		__m128d vInvDeltaDistX = _mm_loadu_pd(invDeltaDistX), vInvDeltaDistY = _mm_loadu_pd(invDeltaDistY);
+		__m128d vStartX = _mm_loadu_pd(cellX), vStartY = _mm_loadu_pd(cellY);
+		__m128d vStepX = _mm_loadu_pd(stepX), vStepY = _mm_loadu_pd(stepY);
+		__m128d positiveStepX = _mm_cmpgt_pd(vStepX,zero), positiveStepY = _mm_cmpgt_pd(vStepY,zero);
+		__m128d vCellX = vStartX, vCellY = vStartY;
+		__m128d vCountX = zero, vCountY = zero;
+		__m128d vNextDistX = vSideDistX, vNextDistY = vSideDistY;
+		__m128d vSide = zero; // all bits set = y-side
+		__m128d active = allBits; // lanes without hit
+		__m128d areaMode = zero; // lanes crossing empty blocks or tiles
+		__m128d vSize = zero, vAreaX = zero, vAreaY = zero, vExitX = zero, vExitY = zero, vExitDistX = zero, vExitDistY = zero;
+		int emptyTiles = 0; // lanes in empty tile
+		for (int lane=0;lane<2;lane++) emptyTiles |= (g_solidTiles[SOLIDTILE((int) cellX[lane],(int) cellY[lane])] == 0) << lane;
+
+		do {
+			//lanes entering empty block or tile
+			int enterBits = emptyTiles & ~_mm_movemask_pd(areaMode) & _mm_movemask_pd(active);
+			if (enterBits) {
+				_mm_storeu_pd(cellX,vCellX);
+				_mm_storeu_pd(cellY,vCellY);
+				for (int lane=0;lane<2;lane++) size[lane] = (g_solidBlocks[SOLIDBLOCK((int) cellX[lane],(int) cellY[lane])] == 0) ? 64 : 8;
+				__m128d enter = _mm_castsi128_pd(_mm_set_epi64x(-(long long)((enterBits >> 1) & 1),-(long long)(enterBits & 1)));
+				__m128d enterSize = _mm_loadu_pd(size);
+				__m128d invSize = _mm_div_pd(one,enterSize);
+				__m128d enterAreaX = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_mul_pd(vCellX,invSize)));
+				__m128d enterAreaY = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_mul_pd(vCellY,invSize)));
+				__m128d offsetX = _mm_sub_pd(vCellX,_mm_mul_pd(enterAreaX,enterSize));
+				__m128d offsetY = _mm_sub_pd(vCellY,_mm_mul_pd(enterAreaY,enterSize));
+				__m128d exitX = _mm_add_pd(vCountX,_mm_sub_pd(selectSSE2(_mm_add_pd(offsetX,one),_mm_sub_pd(enterSize,offsetX),positiveStepX),one));
+				__m128d exitY = _mm_add_pd(vCountY,_mm_sub_pd(selectSSE2(_mm_add_pd(offsetY,one),_mm_sub_pd(enterSize,offsetY),positiveStepY),one));
+				vSize = selectSSE2(vSize,enterSize,enter);
+				vAreaX = selectSSE2(vAreaX,enterAreaX,enter);
+				vAreaY = selectSSE2(vAreaY,enterAreaY,enter);
+				vExitX = selectSSE2(vExitX,exitX,enter);
+				vExitY = selectSSE2(vExitY,exitY,enter);
+				vExitDistX = selectSSE2(vExitDistX,_mm_add_pd(vSideDistX,_mm_mul_pd(exitX,vDeltaDistX)),enter);
+				vExitDistY = selectSSE2(vExitDistY,_mm_add_pd(vSideDistY,_mm_mul_pd(exitY,vDeltaDistY)),enter);
+				areaMode = _mm_or_pd(areaMode,enter);
+			}
+
+			//jump to next map square, either in x-direction, or in y-direction (lanes without hit in non-empty tile)
+			__m128d single = _mm_andnot_pd(areaMode,active);
+			__m128d stepInX = _mm_and_pd(_mm_cmplt_pd(vNextDistX,vNextDistY),single);
+			__m128d stepInY = _mm_andnot_pd(stepInX,single);
+			vCountX = _mm_add_pd(vCountX,_mm_and_pd(stepInX,one));
+			vCellX = _mm_add_pd(vCellX,_mm_and_pd(stepInX,vStepX));
+			vNextDistX = selectSSE2(vNextDistX,_mm_add_pd(vSideDistX,_mm_mul_pd(vCountX,vDeltaDistX)),stepInX);
+			vCountY = _mm_add_pd(vCountY,_mm_and_pd(stepInY,one));
+			vCellY = _mm_add_pd(vCellY,_mm_and_pd(stepInY,vStepY));
+			vNextDistY = selectSSE2(vNextDistY,_mm_add_pd(vSideDistY,_mm_mul_pd(vCountY,vDeltaDistY)),stepInY);
+			vSide = selectSSE2(vSide,stepInY,single);
+			__m128d moved = single; // lanes in new map square
+
+			//jump to next block or tile (lanes in empty block or tile)
+			if (_mm_movemask_pd(areaMode)) {
+				__m128d areaStepInX = _mm_and_pd(_mm_cmplt_pd(vExitDistX,vExitDistY),areaMode);
+				__m128d areaStepInY = _mm_andnot_pd(areaStepInX,areaMode);
+				vAreaX = _mm_add_pd(vAreaX,_mm_and_pd(areaStepInX,vStepX));
+				vAreaY = _mm_add_pd(vAreaY,_mm_and_pd(areaStepInY,vStepY));
+				vSide = selectSSE2(vSide,areaStepInY,areaMode);
+
+				_mm_storeu_pd(areaX,vAreaX);
+				_mm_storeu_pd(areaY,vAreaY);
+				_mm_storeu_pd(size,vSize);
+				int areaBits = _mm_movemask_pd(areaMode), nonEmptyBits = 0;
+				for (int lane=0;lane<2;lane++) {
+					if (((areaBits >> lane) & 1) == 0) continue;
+					int ax = (int) areaX[lane], ay = (int) areaY[lane];
+					if ((size[lane] == 64) ? g_solidBlocks[ay*g_solidBlocksPerRow + ax] != 0 : g_solidTiles[ay*g_solidTilesPerRow + ax] != 0) nonEmptyBits |= 1 << lane;
+				}
+				__m128d nonEmpty = _mm_castsi128_pd(_mm_set_epi64x(-(long long)((nonEmptyBits >> 1) & 1),-(long long)(nonEmptyBits & 1)));
+
+				//empty: step leaving the next block or tile
+				__m128d stayInX = _mm_andnot_pd(nonEmpty,areaStepInX), stayInY = _mm_andnot_pd(nonEmpty,areaStepInY);
+				vExitX = _mm_add_pd(vExitX,_mm_and_pd(stayInX,vSize));
+				vExitDistX = selectSSE2(vExitDistX,_mm_add_pd(vSideDistX,_mm_mul_pd(vExitX,vDeltaDistX)),stayInX);
+				vExitY = _mm_add_pd(vExitY,_mm_and_pd(stayInY,vSize));
+				vExitDistY = selectSSE2(vExitDistY,_mm_add_pd(vSideDistY,_mm_mul_pd(vExitY,vDeltaDistY)),stayInY);
+
+				//non-empty: map square where the ray enters the block or tile
+				if (nonEmptyBits) {
+					__m128d stepsY = stepsBeforeSSE2(vSideDistY,vDeltaDistY,vInvDeltaDistY,vExitY,vExitDistX,true);
+					__m128d stepsX = stepsBeforeSSE2(vSideDistX,vDeltaDistX,vInvDeltaDistX,vExitX,vExitDistY,false);
+					vCountX = selectSSE2(vCountX,selectSSE2(stepsX,_mm_add_pd(vExitX,one),areaStepInX),nonEmpty);
+					vCountY = selectSSE2(vCountY,selectSSE2(_mm_add_pd(vExitY,one),stepsY,areaStepInX),nonEmpty);
+					vCellX = selectSSE2(vCellX,_mm_add_pd(vStartX,_mm_mul_pd(vStepX,vCountX)),nonEmpty);
+					vCellY = selectSSE2(vCellY,_mm_add_pd(vStartY,_mm_mul_pd(vStepY,vCountY)),nonEmpty);
+					vNextDistX = selectSSE2(vNextDistX,_mm_add_pd(vSideDistX,_mm_mul_pd(vCountX,vDeltaDistX)),nonEmpty);
+					vNextDistY = selectSSE2(vNextDistY,_mm_add_pd(vSideDistY,_mm_mul_pd(vCountY,vDeltaDistY)),nonEmpty);
+					areaMode = _mm_andnot_pd(nonEmpty,areaMode);
+					moved = _mm_or_pd(moved,nonEmpty);
+				}
+			}
+
+			//Check if ray has hit a wall (or sentinel border)
+			_mm_storeu_pd(cellX,vCellX);
+			_mm_storeu_pd(cellY,vCellY);
+			int movedBits = _mm_movemask_pd(moved), solidBits = 0;
+			for (int lane=0;lane<2;lane++) {
+				if (((movedBits >> lane) & 1) == 0) continue;
+				int cx = (int) cellX[lane], cy = (int) cellY[lane];
+				unsigned long long tile = g_solidTiles[SOLIDTILE(cx,cy)];
+				solidBits |= ((tile >> SOLIDBIT(cx,cy)) & 1) << lane;
+				emptyTiles = (emptyTiles & ~(1 << lane)) | ((tile == 0) << lane);
+			}
+			active = _mm_andnot_pd(_mm_castsi128_pd(_mm_set_epi64x(-(long long)((solidBits >> 1) & 1),-(long long)(solidBits & 1))),active);
+		} while (_mm_movemask_pd(active));
+
+		_mm_storeu_pd(cellX,vCellX);
+		_mm_storeu_pd(cellY,vCellY);
+		_mm_storeu_pd(countX,vCountX);
+		_mm_storeu_pd(countY,vCountY);
+		int sideBits = _mm_movemask_pd(vSide);
+		for (int lane=0;lane<2;lane++) {
+			RayHit &hit = hits[x-beginX+lane];
+			hit.mapX = (int) cellX[lane] - 1;
+			hit.mapY = (int) cellY[lane] - 1;
+			hit.side = (sideBits >> lane) & 1;
+			hit.offMap = !ISGRIDINMAP(hit.mapX,hit.mapY);
+			//Calculate distance of perpendicular ray (Euclidean distance would give fisheye effect!)
+			if(hit.side == 0) hit.perpWallDist = sideDistX[lane] + (countX[lane]-1)*deltaDistX[lane];
+			else              hit.perpWallDist = sideDistY[lane] + (countY[lane]-1)*deltaDistY[lane];
+		}
+	}
+	if (x < endX) castRaysDDAScalar(x,endX,&hits[x-beginX]); // remaining column
+}
+
+// stepsBefore for 4 lanes (AVX2)
+__attribute__((target("avx2")))
+inline __m256d stepsBeforeAVX2(__m256d sideDist, __m256d deltaDist, __m256d invDeltaDist, __m256d maxSteps, __m256d limit, bool inclusive) {
+	const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1);
+	__m256d estimate = _mm256_min_pd(_mm256_max_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(limit,sideDist),invDeltaDist),one),zero),maxSteps);
+	__m256d k = _mm256_round_pd(estimate,_MM_FROUND_TO_ZERO|_MM_FROUND_NO_EXC);
+	__m256d lastDist = _mm256_add_pd(sideDist,_mm256_mul_pd(_mm256_sub_pd(k,one),deltaDist));
+	__m256d nextDist = _mm256_add_pd(sideDist,_mm256_mul_pd(k,deltaDist));
+	__m256d down = _mm256_and_pd(_mm256_cmp_pd(k,zero,_CMP_GT_OQ),inclusive ? _mm256_cmp_pd(lastDist,limit,_CMP_GT_OQ) : _mm256_cmp_pd(lastDist,limit,_CMP_GE_OQ));
+	__m256d up = _mm256_andnot_pd(down,_mm256_and_pd(_mm256_cmp_pd(k,maxSteps,_CMP_LT_OQ),inclusive ? _mm256_cmp_pd(nextDist,limit,_CMP_LE_OQ) : _mm256_cmp_pd(nextDist,limit,_CMP_LT_OQ)));
+	return _mm256_add_pd(_mm256_sub_pd(k,_mm256_and_pd(down,one)),_mm256_and_pd(up,one));
+}
+
+// Gather 64 bit words of bitmap at word index row*wordsPerRow + column (AVX2, only lanes of mask, others 0)
+__attribute__((target("avx2")))
+inline __m256i gatherSolidWords(const unsigned long long *words, __m256d row, __m256d column, __m256d wordsPerRow, __m256d mask) {
+	__m128i index = _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_mul_pd(row,wordsPerRow),column));
+	return _mm256_mask_i32gather_epi64(_mm256_setzero_si256(),(const long long *) words,index,_mm256_castpd_si256(mask),8);
+}
+
+// Cast DDA rays for screen columns [beginX;endX[ as packets of 4 adjacent rays (AVX2 with gathers from the solid cell bitmap). Same steps as castRaysDDAScalar, so the hits are identical.
+__attribute__((target("avx2")))
+void castRaysDDAAVX2(int beginX, int endX, RayHit *hits) {
+	double sideDistX[4], sideDistY[4], deltaDistX[4], deltaDistY[4], invDeltaDistX[4], invDeltaDistY[4], cellX[4], cellY[4], stepX[4], stepY[4];
+	double countX[4], countY[4];
+	int intStepX, intStepY;
+	int x;
+	const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1);
+	const __m256d allBits = _mm256_castsi256_pd(_mm256_set1_epi32(-1));
+	const __m256d eight = _mm256_set1_pd(8), sixtyFour = _mm256_set1_pd(64), eighth = _mm256_set1_pd(1.0/8), sixtyFourth = _mm256_set1_pd(1.0/64);
+	const __m256d tilesPerRow = _mm256_set1_pd(g_solidTilesPerRow), blocksPerRow = _mm256_set1_pd(g_solidBlocksPerRow);
+	const __m256i zero64 = _mm256_setzero_si256(), bitMask = _mm256_set1_epi64x(1), seven = _mm256_set1_epi64x(7);
+
+	if (!ISGRIDINMAP(g_viewerX,g_viewerY)) { // no sentinel border around viewer
+		castRaysDDAScalar(beginX,endX,hits);
+		return;
+	}
+	for (x = beginX; x+4 <= endX; x+=4) {
+		for (int lane=0;lane<4;lane++) {
+			RayHit &hit = hits[x-beginX+lane];
+			prepareRayDDA(x+lane,hit,sideDistX[lane],sideDistY[lane],deltaDistX[lane],deltaDistY[lane],intStepX,intStepY);
+			invDeltaDistX[lane] = myAbs(hit.rayDirX);
+			invDeltaDistY[lane] = myAbs(hit.rayDirY);
+			cellX[lane] = hit.mapX+1;
+			cellY[lane] = hit.mapY+1;
+			stepX[lane] = intStepX;
+			stepY[lane] = intStepY;
+		}
+		__m256d vSideDistX = _mm256_loadu_pd(sideDistX), vSideDistY = _mm256_loadu_pd(sideDistY);
+		__m256d vDeltaDistX = _mm256_loadu_pd(deltaDistX), vDeltaDistY = _mm256_loadu_pd(deltaDistY);
+		__m256d vInvDeltaDistX = _mm256_loadu_pd(invDeltaDistX), vInvDeltaDistY = _mm256_loadu_pd(invDeltaDistY);
+		__m256d vStartX = _mm256_loadu_pd(cellX), vStartY = _mm256_loadu_pd(cellY);
+		__m256d vStepX = _mm256_loadu_pd(stepX), vStepY = _mm256_loadu_pd(stepY);
+		__m256d positiveStepX = _mm256_cmp_pd(vStepX,zero,_CMP_GT_OQ), positiveStepY = _mm256_cmp_pd(vStepY,zero,_CMP_GT_OQ);
+		__m256d vCellX = vStartX, vCellY = vStartY;
+		__m256d vCountX = zero, vCountY = zero;
+		__m256d vNextDistX = vSideDistX, vNextDistY = vSideDistY;
+		__m256d vSide = zero; // all bits set = y-side
+		__m256d active = allBits; // lanes without hit
+		__m256d areaMode = zero; // lanes crossing empty blocks or tiles
+		__m256d vSize = zero, vAreaX = zero, vAreaY = zero, vExitX = zero, vExitY = zero, vExitDistX = zero, vExitDistY = zero;
+		__m256d tileX = _mm256_floor_pd(_mm256_mul_pd(vCellX,eighth)), tileY = _mm256_floor_pd(_mm256_mul_pd(vCellY,eighth));
+		__m256i tiles = gatherSolidWords(g_solidTiles.data(),tileY,tileX,tilesPerRow,allBits); // tiles of map squares
+
+		do {
+			//lanes entering empty block or tile
+			__m256d enter = _mm256_andnot_pd(areaMode,_mm256_and_pd(active,_mm256_castsi256_pd(_mm256_cmpeq_epi64(tiles,zero64))));
+			if (_mm256_movemask_pd(enter)) {
+				__m256d blockX = _mm256_floor_pd(_mm256_mul_pd(vCellX,sixtyFourth)), blockY = _mm256_floor_pd(_mm256_mul_pd(vCellY,sixtyFourth));
+				__m256d emptyBlock = _mm256_castsi256_pd(_mm256_cmpeq_epi64(gatherSolidWords(g_solidBlocks.data(),blockY,blockX,blocksPerRow,enter),zero64));
+				__m256d enterSize = _mm256_blendv_pd(eight,sixtyFour,emptyBlock);
+				__m256d enterAreaX = _mm256_floor_pd(_mm256_mul_pd(vCellX,_mm256_blendv_pd(eighth,sixtyFourth,emptyBlock)));
+				__m256d enterAreaY = _mm256_floor_pd(_mm256_mul_pd(vCellY,_mm256_blendv_pd(eighth,sixtyFourth,emptyBlock)));
+				__m256d offsetX = _mm256_sub_pd(vCellX,_mm256_mul_pd(enterAreaX,enterSize));
+				__m256d offsetY = _mm256_sub_pd(vCellY,_mm256_mul_pd(enterAreaY,enterSize));
+				__m256d exitX = _mm256_add_pd(vCountX,_mm256_sub_pd(_mm256_blendv_pd(_mm256_add_pd(offsetX,one),_mm256_sub_pd(enterSize,offsetX),positiveStepX),one));
+				__m256d exitY = _mm256_add_pd(vCountY,_mm256_sub_pd(_mm256_blendv_pd(_mm256_add_pd(offsetY,one),_mm256_sub_pd(enterSize,offsetY),positiveStepY),one));
+				vSize = _mm256_blendv_pd(vSize,enterSize,enter);
+				vAreaX = _mm256_blendv_pd(vAreaX,enterAreaX,enter);
+				vAreaY = _mm256_blendv_pd(vAreaY,enterAreaY,enter);
+				vExitX = _mm256_blendv_pd(vExitX,exitX,enter);
+				vExitY = _mm256_blendv_pd(vExitY,exitY,enter);
+				vExitDistX = _mm256_blendv_pd(vExitDistX,_mm256_add_pd(vSideDistX,_mm256_mul_pd(exitX,vDeltaDistX)),enter);
+				vExitDistY = _mm256_blendv_pd(vExitDistY,_mm256_add_pd(vSideDistY,_mm256_mul_pd(exitY,vDeltaDistY)),enter);
+				areaMode = _mm256_or_pd(areaMode,enter);
+			}
+
+			//jump to next map square, either in x-direction, or in y-direction (lanes without hit in non-empty tile)
+			__m256d single = _mm256_andnot_pd(areaMode,active);
+			__m256d stepInX = _mm256_and_pd(_mm256_cmp_pd(vNextDistX,vNextDistY,_CMP_LT_OQ),single);
+			__m256d stepInY = _mm256_andnot_pd(stepInX,single);
+			vCountX = _mm256_add_pd(vCountX,_mm256_and_pd(stepInX,one));
+			vCellX = _mm256_add_pd(vCellX,_mm256_and_pd(stepInX,vStepX));
+			vNextDistX = _mm256_blendv_pd(vNextDistX,_mm256_add_pd(vSideDistX,_mm256_mul_pd(vCountX,vDeltaDistX)),stepInX);
+			vCountY = _mm256_add_pd(vCountY,_mm256_and_pd(stepInY,one));
+			vCellY = _mm256_add_pd(vCellY,_mm256_and_pd(stepInY,vStepY));
+			vNextDistY = _mm256_blendv_pd(vNextDistY,_mm256_add_pd(vSideDistY,_mm256_mul_pd(vCountY,vDeltaDistY)),stepInY);
+			vSide = _mm256_blendv_pd(vSide,stepInY,single);
+			__m256d moved = single; // lanes in new map square
+
+			//jump to next block or tile (lanes in empty block or tile)
+			if (_mm256_movemask_pd(areaMode)) {
+				__m256d areaStepInX = _mm256_and_pd(_mm256_cmp_pd(vExitDistX,vExitDistY,_CMP_LT_OQ),areaMode);
+				__m256d areaStepInY = _mm256_andnot_pd(areaStepInX,areaMode);
+				vAreaX = _mm256_add_pd(vAreaX,_mm256_and_pd(areaStepInX,vStepX));
+				vAreaY = _mm256_add_pd(vAreaY,_mm256_and_pd(areaStepInY,vStepY));
+				vSide = _mm256_blendv_pd(vSide,areaStepInY,areaMode);
+
+				__m256d blockLanes = _mm256_and_pd(_mm256_cmp_pd(vSize,sixtyFour,_CMP_EQ_OQ),areaMode);
+				__m256i words = _mm256_or_si256(gatherSolidWords(g_solidBlocks.data(),vAreaY,vAreaX,blocksPerRow,blockLanes),
+					gatherSolidWords(g_solidTiles.data(),vAreaY,vAreaX,tilesPerRow,_mm256_andnot_pd(blockLanes,areaMode)));
+				__m256d nonEmpty = _mm256_andnot_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(words,zero64)),areaMode);
+
+				//empty: step leaving the next block or tile
+				__m256d stayInX = _mm256_andnot_pd(nonEmpty,areaStepInX), stayInY = _mm256_andnot_pd(nonEmpty,areaStepInY);
+				vExitX = _mm256_add_pd(vExitX,_mm256_and_pd(stayInX,vSize));
+				vExitDistX = _mm256_blendv_pd(vExitDistX,_mm256_add_pd(vSideDistX,_mm256_mul_pd(vExitX,vDeltaDistX)),stayInX);
+				vExitY = _mm256_add_pd(vExitY,_mm256_and_pd(stayInY,vSize));
+				vExitDistY = _mm256_blendv_pd(vExitDistY,_mm256_add_pd(vSideDistY,_mm256_mul_pd(vExitY,vDeltaDistY)),stayInY);
+
+				//non-empty: map square where the ray enters the block or tile
+				if (_mm256_movemask_pd(nonEmpty)) {
+					__m256d stepsY = stepsBeforeAVX2(vSideDistY,vDeltaDistY,vInvDeltaDistY,vExitY,vExitDistX,true);
+					__m256d stepsX = stepsBeforeAVX2(vSideDistX,vDeltaDistX,vInvDeltaDistX,vExitX,vExitDistY,false);
+					vCountX = _mm256_blendv_pd(vCountX,_mm256_blendv_pd(stepsX,_mm256_add_pd(vExitX,one),areaStepInX),nonEmpty);
+					vCountY = _mm256_blendv_pd(vCountY,_mm256_blendv_pd(_mm256_add_pd(vExitY,one),stepsY,areaStepInX),nonEmpty);
+					vCellX = _mm256_blendv_pd(vCellX,_mm256_add_pd(vStartX,_mm256_mul_pd(vStepX,vCountX)),nonEmpty);
+					vCellY = _mm256_blendv_pd(vCellY,_mm256_add_pd(vStartY,_mm256_mul_pd(vStepY,vCountY)),nonEmpty);
+					vNextDistX = _mm256_blendv_pd(vNextDistX,_mm256_add_pd(vSideDistX,_mm256_mul_pd(vCountX,vDeltaDistX)),nonEmpty);
+					vNextDistY = _mm256_blendv_pd(vNextDistY,_mm256_add_pd(vSideDistY,_mm256_mul_pd(vCountY,vDeltaDistY)),nonEmpty);
+					areaMode = _mm256_andnot_pd(nonEmpty,areaMode);
+					moved = _mm256_or_pd(moved,nonEmpty);
+				}
+			}
+
+			//Check if ray has hit a wall (or sentinel border) by gathering the tiles of the bitmap
+			tileX = _mm256_floor_pd(_mm256_mul_pd(vCellX,eighth));
+			tileY = _mm256_floor_pd(_mm256_mul_pd(vCellY,eighth));
+			tiles = gatherSolidWords(g_solidTiles.data(),tileY,tileX,tilesPerRow,allBits);
+			__m256i cellBitX = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(vCellX,_mm256_set1_pd(4503599627370496.0))),_mm256_castpd_si256(_mm256_set1_pd(4503599627370496.0)));
+			__m256i cellBitY = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(vCellY,_mm256_set1_pd(4503599627370496.0))),_mm256_castpd_si256(_mm256_set1_pd(4503599627370496.0)));
+			__m256i bit = _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(cellBitY,seven),3),_mm256_and_si256(cellBitX,seven));
+			__m256i solid = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_srlv_epi64(tiles,bit),bitMask),bitMask);
+			active = _mm256_andnot_pd(_mm256_and_pd(_mm256_castsi256_pd(solid),moved),active);
+		} while (_mm256_movemask_pd(active));
+
+		_mm256_storeu_pd(cellX,vCellX);
+		_mm256_storeu_pd(cellY,vCellY);
+		_mm256_storeu_pd(countX,vCountX);
+		_mm256_storeu_pd(countY,vCountY);
+		int sideBits = _mm256_movemask_pd(vSide);
+		for (int lane=0;lane<4;lane++) {
+			RayHit &hit = hits[x-beginX+lane];
+			hit.mapX = (int) cellX[lane] - 1;
+			hit.mapY = (int) cellY[lane] - 1;
+			hit.side = (sideBits >> lane) & 1;
+			hit.offMap = !ISGRIDINMAP(hit.mapX,hit.mapY);
+			//Calculate distance of perpendicular ray (Euclidean distance would give fisheye effect!)
+			if(hit.side == 0) hit.perpWallDist = sideDistX[lane] + (countX[lane]-1)*deltaDistX[lane];
+			else              hit.perpWallDist = sideDistY[lane] + (countY[lane]-1)*deltaDistY[lane];
+		}
+	}
+	if (x < endX) castRaysDDAScalar(x,endX,&hits[x-beginX]); // remaining columns
+}
+#endif
+
+// Select DDA ray and background kernels dependent on cpu features (CPUID) and --simd option
+void selectKernels() {
+	g_castRaysDDA = castRaysDDAScalar;
+	g_drawBackgroundSpan = drawBackgroundSpanScalar;
+	g_kernelName = "scalar";
+	#ifdef SIMDX86
+	__builtin_cpu_init();
+	if (g_simdMode == SIMDOFF) return;
+	if (((g_simdMode == SIMDAUTO) || (g_simdMode == SIMDAVX2)) && __builtin_cpu_supports("avx2")) {
+		g_castRaysDDA = castRaysDDAAVX2;
+		g_drawBackgroundSpan = drawBackgroundSpanAVX2;
+		g_kernelName = "avx2";
+		return;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		g_castRaysDDA = castRaysDDASSE2;
+		g_kernelName = "sse2";
+	}
+	#endif
+}
+
+// Cast DDA rays for screen columns [beginX;endX[ into g_wallHits and set background rows hidden by the walls
+void castWallRaysDDAColumns(int beginX, int endX) {
+	for (int x = beginX; x < endX; x += RAYPACKETCOLUMNS) g_castRaysDDA(x,std::min(x+RAYPACKETCOLUMNS,endX),&g_wallHits[x]);
+
+	for (int x = beginX; x < endX; x++) {
+		const RayHit &hit = g_wallHits[x];
+		double perpWallDist = hit.perpWallDist;
+		if (perpWallDist == 0) perpWallDist = 0.0001; // Prevent DIV0 like drawRaycastDDAColumns
+		if (hit.offMap) g_wallCover[x] = 0;
+		else g_wallCover[x] = wallCover(wallLineHeight(perpWallDist),MAPCELL(g_wallMap,hit.mapX,hit.mapY)-1);
+		g_animatedColumns[x] = 0; // set by wall and sprite columns
+
+	}
+}
+
+// Raycaster via DDA for screen columns [beginX;endX[ with rays from castWallRaysDDAColumns (based on https://lodev.org/cgtutor/raycasting.html, (c) 2004-2021, Lode Vandevenne)
+void drawRaycastDDAColumns(int beginX, int endX) {
+	int red,green,blue;
+	float darken;
+	const unsigned char *light;
+
+	//WALL CASTING
+    for(int x = beginX; x < endX; x++) {    	
+		RayHit &hit = g_wallHits[x];
+		double rayDirX = hit.rayDirX;
+		double rayDirY = hit.rayDirY;
+		int mapX = hit.mapX;
+		int mapY = hit.mapY;
+		int side = hit.side;
+		bool offMap = hit.offMap;
+		double perpWallDist = hit.perpWallDist;
 		
 		if (perpWallDist == 0) perpWallDist = 0.0001; // Prevent DIV0, can occur if position is very, very close to a wall
 		//Calculate height of line to draw on screen
-		int lineHeight = (int)(g_viewPort3dHeight / perpWallDist); // +4 in my case to fill the gaps between wall, floor and roof (or add floor and roof also for walls)
-		if (lineHeight & 1) lineHeight ++; // odd height for better symetry
+		int lineHeight = wallLineHeight(perpWallDist);
 
 		darken = 1+perpWallDist/10.0f; // darken wall if far away
 	
-		if (!g_fullScreenMode) {
-	  		// draw FOV
-			glColor3f(0,1,0);
-			glLineWidth(1);
-			glBegin(GL_LINES);
-			glVertex2i(g_viewerX*GRIDSIZE,g_viewerY*GRIDSIZE);
-			glVertex2i((g_viewerX+(g_cachedCos+g_cachedCos90))*GRIDSIZE,(g_viewerY+(g_cachedSin+g_cachedSin90))*GRIDSIZE);
-			glVertex2i(g_viewerX*GRIDSIZE,g_viewerY*GRIDSIZE);
-			glVertex2i((g_viewerX+(g_cachedCos-g_cachedCos90))*GRIDSIZE,(g_viewerY+(g_cachedSin-g_cachedSin90))*GRIDSIZE);
-			glEnd();
-		}	
-	
 		if (offMap) continue; // no wall
 
 		if (lineHeight<2) continue; // wall too small
@@ -807,7 +2438,8 @@ void drawRaycastDDA() {
 		if (g_showTextures) {
 
 			//texturing calculations
-			int texNum = g_wallMap[mapY][mapX] -1;  // Nr. of texture
+			int texNum = MAPCELL(g_wallMap,mapX,mapY) -1;  // Nr. of texture
+			if (g_transparentTextures[texNum] && (g_animatedTexels[texNum] != 0)) g_animatedColumns[x] = 1;
 					
 			//calculate value of wallX
 			double wallX; //where exactly the wall was hit
@@ -816,30 +2448,33 @@ void drawRaycastDDA() {
 			wallX -= floor((wallX));
 			
 			//x coordinate on the texture
-			int texX = int(wallX * double(TEXTURESIZE));
-			if(side == 0 && rayDirX > 0) texX = TEXTURESIZE - texX - 1;
-			if(side == 1 && rayDirY < 0) texX = TEXTURESIZE - texX - 1;
+			int texX = int(wallX * double(g_textureSize));
+			if(side == 0 && rayDirX > 0) texX = g_textureSize - texX - 1;
+			if(side == 1 && rayDirY < 0) texX = g_textureSize - texX - 1;
 		
 			// How much to increase the texture coordinate per screen pixel
-			double step = 1.0 * TEXTURESIZE / (lineHeight-1);
+			double step = 1.0 * g_textureSize / (lineHeight-1);
 			
 			// Starting texture coordinate
 			double texPos = (double) (drawStart - g_viewPort3dHalfHeight + lineHeight / 2) * step;
-			glPointSize(g_pixelSize);
-			glBegin(GL_POINTS);
+			light = g_lightTable[lightLevel(darken,side == 1)];
+			int mipLevel = wallMipLevel(lineHeight);
+			const unsigned int *textureColumn = TEXTUREMIPCOLUMN(mipLevel,texNum,(g_textureSize-texX-1) >> mipLevel);
+			int textureMask = g_textureSize - 1;
+			beginPixels();
 	
 			for(int y = drawStart; y<drawEnd; y++) {
 				// Cast the texture coordinate to integer, and mask with (texHeight - 1) in case of overflow
-				int texY = (int)texPos & (TEXTURESIZE - 1);
+				int texY = ((int)texPos & textureMask) >> mipLevel;
 				texPos += step;
 				
-				int pixel = ((int)texY*TEXTURESIZE + TEXTURESIZE-texX-1)*3;
-				if (getTextureColor(texNum, side == 1, pixel, darken, red, green, blue)) {
-					glColor3ub(red,green,blue); 
-					glVertex2i(g_viewPort3dOffsetX + x*g_pixelSize+g_pixelOffset,y*g_pixelSize+g_pixelOffset);
+				if (getTextureColor(texNum, textureColumn[texY], light, red, green, blue)) {
+					drawPixel(x,y,red,green,blue);
 				}
 			}
-			glEnd();
+			endPixels();
+		} else if (g_useFrameBuffer) { // no textures enabled
+			if (side != 0) fillFrameBufferColumn(x,drawStart,drawEnd,RGBA(255/darken,0,0)); else fillFrameBufferColumn(x,drawStart,drawEnd,RGBA(0,255/darken,0));
 		} else { // no textures enabled
 			if (side != 0) glColor3f(1/darken,0,0); else glColor3f(0,1/darken,0);
 			glLineWidth(g_pixelSize);
@@ -851,138 +2486,361 @@ void drawRaycastDDA() {
 	}	
 }
 
+// Draw FOV of DDA raycasters into 2d map
+void drawFieldOfView() {
+	glColor3f(0,1,0);
+	glLineWidth(1);
+	glBegin(GL_LINES);
+	glVertex2i(g_viewerX*g_gridSize,g_viewerY*g_gridSize);
+	glVertex2i((g_viewerX+(g_cachedCos+g_cachedCos90))*g_gridSize,(g_viewerY+(g_cachedSin+g_cachedSin90))*g_gridSize);
+	glVertex2i(g_viewerX*g_gridSize,g_viewerY*g_gridSize);
+	glVertex2i((g_viewerX+(g_cachedCos-g_cachedCos90))*g_gridSize,(g_viewerY+(g_cachedSin-g_cachedSin90))*g_gridSize);
+	glEnd();
+}
+
+// Raycaster via DDA
+void drawRaycastDDA() {
+	if (!g_fullScreenMode) drawFieldOfView();
+
+	if (g_useFrameBuffer) {
+		parallelFor(g_viewPort3dWidth,drawRaycastDDAColumns); // columns in bands on all threads
+	} else drawRaycastDDAColumns(0,g_viewPort3dWidth);
+}
+
+// Side distance of step i of a fixed point DDA axis (sideDist + i*deltaDist), limited to FIXEDFAR
+inline unsigned int sideDistFixed(unsigned int sideDist, unsigned int deltaDist, int i) {
+	unsigned long long dist = sideDist + (unsigned long long) i*deltaDist;
+	return (dist < FIXEDFAR) ? dist : FIXEDFAR;
+}
+
+// stepsBefore for fixed point DDA axis (integer side distances are exact, so the estimate is corrected until it fits)
+inline int stepsBeforeFixed(unsigned int sideDist, unsigned int deltaDist, unsigned int invDeltaDist, int maxSteps, unsigned int limit, bool inclusive) {
+	if (inclusive ? sideDist > limit : sideDist >= limit) return 0;
+	int k = (((unsigned long long) (limit - sideDist)*invDeltaDist) >> (2*FIXEDSHIFT)) + 1; // distance * 16.16 ray direction = steps in 32.32
+	if (k > maxSteps) k = maxSteps;
+	while ((k > 1) && (inclusive ? sideDistFixed(sideDist,deltaDist,k-1) > limit : sideDistFixed(sideDist,deltaDist,k-1) >= limit)) k--;
+	while ((k < maxSteps) && (inclusive ? sideDistFixed(sideDist,deltaDist,k) <= limit : sideDistFixed(sideDist,deltaDist,k) < limit)) k++;
+	return k;
+}
+
+// Cast fixed point DDA ray for screen column x, same traversal as castRaysDDAScalar with 16.16 integers (viewer has to be in map)
+void castRayFixed(int x, RayHitFixed &hit) {
+	unsigned int sideDistX, sideDistY, deltaDistX, deltaDistY, invDeltaDistX, invDeltaDistY;
+	int stepX, stepY;
+	int viewerX = g_viewerX*FIXEDONE, viewerY = g_viewerY*FIXEDONE;
+	int fractionX = viewerX & (FIXEDONE-1), fractionY = viewerY & (FIXEDONE-1);
+
+	//calculate ray direction
+	hit.rayDirX = g_dirXFixed + (int) (((long long) g_planeXFixed*g_cameraXFixed[x] + FIXEDONE/2) >> FIXEDSHIFT);
+	hit.rayDirY = g_dirYFixed + (int) (((long long) g_planeYFixed*g_cameraXFixed[x] + FIXEDONE/2) >> FIXEDSHIFT);
+
+	//length of ray from one x or y-side to next x or y-side (by reciprocal table)
+	invDeltaDistX = myAbs(hit.rayDirX);
+	invDeltaDistY = myAbs(hit.rayDirY);
+	deltaDistX = std::min(reciprocalFixed(invDeltaDistX),FIXEDFAR);
+	deltaDistY = std::min(reciprocalFixed(invDeltaDistY),FIXEDFAR);
+
+	//calculate step and initial sideDist
+	stepX = (hit.rayDirX < 0) ? -1 : 1;
+	stepY = (hit.rayDirY < 0) ? -1 : 1;
+	sideDistX = (((unsigned long long) ((hit.rayDirX < 0) ? fractionX : FIXEDONE - fractionX)*deltaDistX) >> FIXEDSHIFT);
+	sideDistY = (((unsigned long long) ((hit.rayDirY < 0) ? fractionY : FIXEDONE - fractionY)*deltaDistY) >> FIXEDSHIFT);
+
+	//perform DDA, empty tiles and blocks are crossed by a DDA on tile or block level (see castRaysDDAScalar)
+	int startX = (viewerX >> FIXEDSHIFT)+1, startY = (viewerY >> FIXEDSHIFT)+1; // map square of viewer in bitmap
+	int cellX = startX, cellY = startY, side = 0;
+	int countX = 0, countY = 0; // steps done in x and y direction
+	unsigned int nextDistX = sideDistX, nextDistY = sideDistY; // side distances of next steps
+	unsigned long long tile = g_solidTiles[SOLIDTILE(cellX,cellY)]; // tile of map square (0 = empty tile)
+	hit.offMap = true;
+	while (true) {
+		if (tile != 0) {
+			//jump to next map square, either in x-direction, or in y-direction
+			if (nextDistX < nextDistY) {
+				if (nextDistX >= FIXEDFAR) return;
+				countX++;
+				cellX += stepX;
+				nextDistX += deltaDistX;
+				side = 0;
+			} else {
+				if (nextDistY >= FIXEDFAR) return;
+				countY++;
+				cellY += stepY;
+				nextDistY += deltaDistY;
+				side = 1;
+			}
+		} else {
+			//cross empty blocks (64x64 squares) or tiles (8x8 squares), until the ray enters a non-empty one
+			int shift = 3;
+			if (g_solidBlocks[SOLIDBLOCK(cellX,cellY)] == 0) shift = 6;
+			int size = 1 << shift;
+			int areaX = cellX >> shift, areaY = cellY >> shift;
+			int exitX = countX + ((stepX > 0) ? size - (cellX & (size-1)) : (cellX & (size-1)) + 1) - 1; // step leaving area in x direction
+			int exitY = countY + ((stepY > 0) ? size - (cellY & (size-1)) : (cellY & (size-1)) + 1) - 1; // step leaving area in y direction
+			unsigned int exitDistX = sideDistFixed(sideDistX,deltaDistX,exitX);
+			unsigned int exitDistY = sideDistFixed(sideDistY,deltaDistY,exitY);
+			while (true) {
+				if (exitDistX < exitDistY) {
+					areaX += stepX;
+					side = 0;
+				} else {
+					if (exitDistY >= FIXEDFAR) return;
+					areaY += stepY;
+					side = 1;
+				}
+				if ((shift == 6) ? g_solidBlocks[areaY*g_solidBlocksPerRow + areaX] != 0 : g_solidTiles[areaY*g_solidTilesPerRow + areaX] != 0) break;
+				if (side == 0) exitDistX = sideDistFixed(sideDistX,deltaDistX,exitX += size);
+				else exitDistY = sideDistFixed(sideDistY,deltaDistY,exitY += size);
+			}
+			//map square where the ray enters the non-empty area
+			if (side == 0) {
+				countX = exitX+1;
+				countY = stepsBeforeFixed(sideDistY,deltaDistY,invDeltaDistY,exitY,exitDistX,true);
+			} else {
+				countY = exitY+1;
+				countX = stepsBeforeFixed(sideDistX,deltaDistX,invDeltaDistX,exitX,exitDistY,false);
+			}
+			cellX = startX + stepX*countX;
+			cellY = startY + stepY*countY;
+			nextDistX = sideDistFixed(sideDistX,deltaDistX,countX);
+			nextDistY = sideDistFixed(sideDistY,deltaDistY,countY);
+		}
+		//Check if ray has hit a wall (or sentinel border)
+		tile = g_solidTiles[SOLIDTILE(cellX,cellY)];
+		if ((tile >> SOLIDBIT(cellX,cellY)) & 1) break;
+	}
+	hit.mapX = cellX-1;
+	hit.mapY = cellY-1;
+	hit.side = side;
+	hit.offMap = !ISGRIDINMAP(hit.mapX,hit.mapY);
+
+	//Calculate distance of perpendicular ray (Euclidean distance would give fisheye effect!)
+	if (side == 0) hit.perpWallDist = sideDistFixed(sideDistX,deltaDistX,countX-1);
+	else           hit.perpWallDist = sideDistFixed(sideDistY,deltaDistY,countY-1);
+}
+
+// Cast fixed point DDA rays for screen columns [beginX;endX[ into g_wallHitsFixed and set background rows hidden by the walls
+void castWallRaysFixedColumns(int beginX, int endX) {
+	memset(&g_animatedColumns[beginX],0,endX-beginX); // set by wall and sprite columns
+	if (!ISGRIDINMAP(g_viewerX,g_viewerY)) { // no sentinel border around viewer, no walls drawn
+		for (int x = beginX; x < endX; x++) g_wallCover[x] = 0;
+		return;
+	}
+	for (int x = beginX; x < endX; x++) {
+		RayHitFixed &hit = g_wallHitsFixed[x];
+		castRayFixed(x,hit);
+		if (hit.offMap) g_wallCover[x] = 0;
+		else g_wallCover[x] = wallCover(wallLineHeightFixed(std::max(hit.perpWallDist,7u)),MAPCELL(g_wallMap,hit.mapX,hit.mapY)-1);
+	}
+}
+
+// Raycaster via DDA in 16.16 fixed point for screen columns [beginX;endX[ with rays from castWallRaysFixedColumns (same images as drawRaycastDDAColumns, all divisions by reciprocal table)
+void drawRaycastFixedColumns(int beginX, int endX) {
+	int red,green,blue;
+	const unsigned char *light;
+	int viewerX = g_viewerX*FIXEDONE, viewerY = g_viewerY*FIXEDONE;
+
+	if (!ISGRIDINMAP(g_viewerX,g_viewerY)) return; // no sentinel border around viewer
+
+	//WALL CASTING
+	for(int x = beginX; x < endX; x++) {
+		const RayHitFixed &hit = g_wallHitsFixed[x];
+		if (hit.offMap) continue; // no wall
+
+		unsigned int perpWallDist = hit.perpWallDist;
+		if (perpWallDist < 7) perpWallDist = 7; // Prevent DIV0 (0.0001), can occur if position is very, very close to a wall
+		//Calculate height of line to draw on screen
+		int lineHeight = wallLineHeightFixed(perpWallDist);
+		if (lineHeight<2) continue; // wall too small
+
+		unsigned int darken = FIXEDONE + perpWallDist/10; // darken wall if far away
+
+		//SET THE ZBUFFER FOR THE SPRITE CASTING
+		g_zBuffer[x] = (double) perpWallDist / FIXEDONE; //perpendicular distance is used
+
+		//calculate lowest and highest pixel to fill in current stripe
+		int drawStart = -lineHeight / 2 + g_viewPort3dHalfHeight;
+		if(drawStart < 0) drawStart = 0;
+		int drawEnd = lineHeight / 2 + g_viewPort3dHalfHeight;
+		if(drawEnd > g_viewPort3dHeight) drawEnd = g_viewPort3dHeight;
+
+		if (g_showTextures) {
+			//texturing calculations
+			int texNum = MAPCELL(g_wallMap,hit.mapX,hit.mapY) -1;  // Nr. of texture
+			if (g_transparentTextures[texNum] && (g_animatedTexels[texNum] != 0)) g_animatedColumns[x] = 1;
+
+			//fraction of wall position, where exactly the wall was hit
+			int wallX;
+			if (hit.side == 0) wallX = viewerY + (int) (((long long) perpWallDist*hit.rayDirY) >> FIXEDSHIFT);
+			else               wallX = viewerX + (int) (((long long) perpWallDist*hit.rayDirX) >> FIXEDSHIFT);
+
+			//x coordinate on the texture
+			int texX = (wallX & (FIXEDONE-1)) >> (FIXEDSHIFT - g_textureShift);
+			if(hit.side == 0 && hit.rayDirX > 0) texX = g_textureSize - texX - 1;
+			if(hit.side == 1 && hit.rayDirY < 0) texX = g_textureSize - texX - 1;
+
+			// How much to increase the texture coordinate per screen pixel (16.16)
+			unsigned int step = ((unsigned long long) g_textureSize*reciprocalFixed(lineHeight-1)) >> FIXEDSHIFT;
+
+			// Starting texture coordinate (16.16, wraps around like the texture)
+			unsigned int texPos = (long long) (drawStart - g_viewPort3dHalfHeight + lineHeight / 2) * step;
+			light = g_lightTable[lightLevelFixed(darken,hit.side == 1)];
+			int mipLevel = wallMipLevel(lineHeight);
+			const unsigned int *textureColumn = TEXTUREMIPCOLUMN(mipLevel,texNum,(g_textureSize-texX-1) >> mipLevel);
+			int textureMask = g_textureSize - 1;
+			beginPixels();
+
+			for(int y = drawStart; y<drawEnd; y++) {
+				int texY = ((texPos >> FIXEDSHIFT) & textureMask) >> mipLevel;
+				texPos += step;
+
+				if (getTextureColor(texNum, textureColumn[texY], light, red, green, blue)) {
+					drawPixel(x,y,red,green,blue);
+				}
+			}
+			endPixels();
+		} else { // no textures enabled
+			int color = (255*(unsigned long long) reciprocalFixed(darken)) >> FIXEDSHIFT;
+			if (g_useFrameBuffer) {
+				if (hit.side != 0) fillFrameBufferColumn(x,drawStart,drawEnd,RGBA(color,0,0)); else fillFrameBufferColumn(x,drawStart,drawEnd,RGBA(0,color,0));
+			} else {
+				if (hit.side != 0) glColor3ub(color,0,0); else glColor3ub(0,color,0);
+				glLineWidth(g_pixelSize);
+				glBegin(GL_LINES);
+				glVertex2i(g_viewPort3dOffsetX + x*g_pixelSize+g_lineOffset,drawStart*g_pixelSize-1);
+				glVertex2i(g_viewPort3dOffsetX + x*g_pixelSize+g_lineOffset,drawEnd*g_pixelSize-1);
+				glEnd();
+			}
+		}
+	}
+}
+
+// Raycaster via DDA in 16.16 fixed point
+void drawRaycastFixed() {
+	if (!g_fullScreenMode) drawFieldOfView();
+
+	if (g_useFrameBuffer) {
+		parallelFor(g_viewPort3dWidth,drawRaycastFixedColumns); // columns in bands on all threads
+	} else drawRaycastFixedColumns(0,g_viewPort3dWidth);
+}
+
 // Draw raycasted scene (inspired on raycaster ideas from https://github.com/3DSage/OpenGL-Raycaster_v1 and https://github.com/3DSage/OpenGL-Raycaster_v2)
 void drawRaycast() {
-	float finalCrossingX,finalCrossingY;
-	float angle;
-	double crossingX, crossingY;
-	float centerCrossingX, centerCrossingY, centerCrossingI;
+	double finalCrossingX,finalCrossingY; // double like the crossings (float may round into the neighbour cell)
+	double verticalX, verticalY, horizontalX, horizontalY; // next crossing with vertical and horizontal wall faces
+	double verticalDeltaX = 0, verticalDeltaY = 0, horizontalDeltaX = 0, horizontalDeltaY = 0;
+	double verticalDistance, horizontalDistance; // distance of next crossings (NOCROSSING = finished)
+	double verticalDeltaDistance = 0, horizontalDeltaDistance = 0;
+	float centerCrossingX = g_viewerX, centerCrossingY = g_viewerY, centerCrossingI = 0;
 	double distanceX,distanceY;
+	double maxDistance;
 	float minDistance;
 	int height;
-	double cachedCos, cachedSin, cachedTan;
+	double cachedCos, cachedSin;
 	double cachedFishEyeCos;
 	int side;
 	int lastSide = SIDEUNKNOWN;
-	bool finalCrossingFound;
-	double deltaX, deltaY;
-	float angleStep;
-	float centerAngleDiff = HUGEBIGNUMBER;
+	double deltaY;
 	int beginOfStripe;
-	double textureX, textureY;
+	double textureX = 0, textureY = 0;
 	int red, green, blue;
-	int pixel;
+	int pixel = 0;
 	int texture;
 	float darken;
-	bool horizontalOffMap, verticalOffMap;
+	const unsigned char *light;
+	bool horizontalOffMap, verticalOffMap, offMap;
 	bool isInMap = false;
+	double viewerCos = cos(M_PI*g_viewerAngle/180);
+	double viewerSin = sin(M_PI*g_viewerAngle/180);
 	static GLint autoSkyRotateTime = 0;
 	static int autoSkyRotate = 0;
 	
-	if (glutGet(GLUT_ELAPSED_TIME) - autoSkyRotateTime > 100) { // move sky every 100 ms one texture pixel
+	if (getElapsedTime() - autoSkyRotateTime > SKYROTATEINTERVAL) { // move sky every 100 ms one texture pixel
 		autoSkyRotate++;
-		autoSkyRotateTime=glutGet(GLUT_ELAPSED_TIME);
+		autoSkyRotateTime=getElapsedTime();
 	}
+	if (g_showBackground) requestImageChange(autoSkyRotateTime+SKYROTATEINTERVAL+1);
 
-	int textureSkyGroundOffsetViewer = (float) (6*SKYSCALE*TEXTURESIZE*g_viewerAngle/360); // texture offset for ground and sky, dependent on viewer rotation	
-	int textureSkyGroundOffsetAutoRotate = (autoSkyRotate+ textureSkyGroundOffsetViewer/SKYSCALE)%TEXTURESIZE; // texture pixel offset for ground and sky, dependent on viewer rotation and time
-	int textureSkyGroundOffsetStatic = (textureSkyGroundOffsetViewer/SKYSCALE)%TEXTURESIZE; // texture pixel offset for ground and sky, dependent on viewer rotation
-
-	// Angle step dependent on viewport aspect ratio and stripe width
- 	angleStep = g_viewPort3dWidth / (PREVEREDVIEWANGLE*((float) g_viewPort3dWidth/g_viewPort3dHeight));
+	int textureSkyGroundOffsetViewer = (float) (6*SKYSCALE*g_textureSize*g_viewerAngle/360); // texture offset for ground and sky, dependent on viewer rotation	
+	int textureSkyGroundOffsetAutoRotate = (autoSkyRotate+ textureSkyGroundOffsetViewer/SKYSCALE)%g_textureSize; // texture pixel offset for ground and sky, dependent on viewer rotation and time
+	int textureSkyGroundOffsetStatic = (textureSkyGroundOffsetViewer/SKYSCALE)%g_textureSize; // texture pixel offset for ground and sky, dependent on viewer rotation
 
 	for (int viewPortX=0;viewPortX<g_viewPort3dWidth;viewPortX++) {
 
-		// new ray angle and fix angle to element of [0;360[
-		angle = (float) g_viewerAngle - ((g_viewPort3dWidth-1)/2 - viewPortX) / angleStep;
-		if (angle < 0) angle += 360;
-		if (angle > 360) angle -= 360;
-		
+		// ray direction by viewer angle and angle table (angle addition theorem)
+		cachedCos = viewerCos*g_rayAngleCos[viewPortX] - viewerSin*g_rayAngleSin[viewPortX];
+		cachedSin = viewerSin*g_rayAngleCos[viewPortX] + viewerCos*g_rayAngleSin[viewPortX];
+		cachedFishEyeCos = g_rayAngleCos[viewPortX];
 		side = SIDEUNKNOWN;
-		finalCrossingFound = false;
-		crossingX = g_viewerX;
-		crossingY = g_viewerY;
-		cachedSin = sin(M_PI*angle/180);
-		cachedCos = cos(M_PI*angle/180);
-		if (cachedCos != 0) cachedTan = cachedSin/cachedCos; else cachedTan = HUGEBIGNUMBER; // replacement for tan(M_PI*angle/180); 
-		cachedTan = tan(M_PI*angle/180);
-		cachedFishEyeCos = cos(M_PI*(g_viewerAngle-angle)/180);
 		distanceX = HUGEBIGNUMBER;
 		distanceY = HUGEBIGNUMBER;
+		verticalOffMap = true;
+		horizontalOffMap = true;
+
+		// first crossing with vertical wall face (left or right)
+		verticalDistance = NOCROSSING;
+		verticalX = g_viewerX;
+		verticalY = g_viewerY;
+		if ((cachedCos > 0.001) || (cachedCos < -0.001)) { // not too close to up or down
+			verticalDeltaX = (cachedCos > 0) ? 1 : -1;
+			verticalX = (cachedCos > 0) ? (int)g_viewerX+1 : ((int)g_viewerX)-0.0001; // grid on right or left
+			verticalY = g_viewerY - (g_viewerX - verticalX)*cachedSin/cachedCos;
+			verticalDeltaY = verticalDeltaX*cachedSin/cachedCos;
+			verticalDistance = cachedCos*(verticalX-g_viewerX)+cachedSin*(verticalY-g_viewerY);
+			verticalDeltaDistance = cachedCos*verticalDeltaX+cachedSin*verticalDeltaY;
+		}
 
-		do { // left or right (crossing vertical wall faces)
-			if ((crossingX == g_viewerX) && (crossingY == g_viewerY)) { // first step
-				if (cachedCos > 0.001){ // right
-					crossingX=(int)g_viewerX+1; // grid on right
-					crossingY=g_viewerY - (g_viewerX - crossingX)*cachedTan;
-					// delta for the next steps
-					deltaX = 1;
-					deltaY = deltaX*cachedTan;
-			 	} else if (cachedCos < -0.001){ // left
-					crossingX=((int)g_viewerX)-0.0001; // grid on left
-					crossingY=g_viewerY - (g_viewerX - crossingX)*cachedTan;
-					deltaX = -1;
-					deltaY = deltaX*cachedTan;
-				} else {
-					// too close to up or down
-					crossingX=g_viewerX; 
-					crossingY=g_viewerY; 
-					finalCrossingFound = true;
-			 	}
-			 } else { // following steps
-			 	verticalOffMap = !ISGRIDINMAP(crossingX,crossingY);
-				if (verticalOffMap || ISGRIDFILLED(crossingX,crossingY)) { // Wall found
-			  		distanceX=cachedCos*(crossingX-g_viewerX)+cachedSin*(crossingY-g_viewerY); // calculate distance between points by using transformation of Pythagorean trigonometric identity (faster then sqrt(dx^2+dy^2)).
-			  		finalCrossingFound = true;
+		// first crossing with horizontal wall face (up or down)
+		horizontalDistance = NOCROSSING;
+		horizontalX = g_viewerX;
+		horizontalY = g_viewerY;
+		if ((cachedSin > 0.001) || (cachedSin < -0.001)) { // not too close to left or right
+			horizontalDeltaY = (cachedSin > 0) ? 1 : -1;
+			horizontalY = (cachedSin > 0) ? (int)g_viewerY+1 : ((int)g_viewerY)-0.0001; // grid below or above
+			horizontalX = g_viewerX - (g_viewerY - horizontalY)*cachedCos/cachedSin;
+			horizontalDeltaX = horizontalDeltaY*cachedCos/cachedSin;
+			horizontalDistance = cachedCos*(horizontalX-g_viewerX)+cachedSin*(horizontalY-g_viewerY);
+			horizontalDeltaDistance = cachedCos*horizontalDeltaX+cachedSin*horizontalDeltaY;
+		}
+
+		// follow both crossings in one pass, always the nearer one, until the first wall. After a wall, only crossings nearly as near (see side decision below) are followed.
+		// The distance of the wall is calculated by using transformation of Pythagorean trigonometric identity (faster then sqrt(dx^2+dy^2)).
+		maxDistance = HUGEBIGNUMBER;
+		while (true) {
+			if (verticalDistance <= horizontalDistance) {
+				if (verticalDistance > maxDistance) break;
+				if (ISCROSSINGSTOP(verticalX,verticalY)) { // Wall found or outer
+				 	verticalOffMap = !ISGRIDINMAP(verticalX,verticalY);
+			  		distanceX = cachedCos*(verticalX-g_viewerX)+cachedSin*(verticalY-g_viewerY);
+					verticalDistance = NOCROSSING;
+					if (distanceX + 0.02 < maxDistance) maxDistance = distanceX + 0.02;
 				} else {
-					crossingX+=deltaX;
-					crossingY+=deltaY;
+					verticalX+=verticalDeltaX;
+					verticalY+=verticalDeltaY;
+					verticalDistance+=verticalDeltaDistance;
 				}
-			 }			
-		} while (!finalCrossingFound);
-		
-		finalCrossingX = crossingX;
-		finalCrossingY = crossingY;
-		crossingX = g_viewerX;
-		crossingY = g_viewerY;
-		finalCrossingFound = false;
-		if (cachedTan == 0)  cachedTan = 0.001; // Prevent DIV0
-		
-		do { // up or down (crossing horizontal wall faces)
-			if ((crossingX == g_viewerX) && (crossingY == g_viewerY)) { // first step
-				if (cachedSin < -0.001){ // up
-					crossingY=((int)g_viewerY)-0.0001; // upper grid
-					crossingX=g_viewerX - (g_viewerY - crossingY)/cachedTan;
-					// delta for the next steps
-					deltaY = -1;
-					deltaX = deltaY/cachedTan;
-			 	} else if (cachedSin > 0.001){ // down
-					crossingY=(int)g_viewerY+1;
-					crossingX=g_viewerX - (g_viewerY - crossingY)/cachedTan;
-					deltaY = 1;
-					deltaX = deltaY/cachedTan;
-				} else {
-					// too close to left or right
-					crossingX=g_viewerX; 
-					crossingY=g_viewerY; 
-					finalCrossingFound = true;
-			 	}
-
-			 } else { // following steps
-			 	horizontalOffMap = !ISGRIDINMAP(crossingX,crossingY);	 
-				if (horizontalOffMap || ISGRIDFILLED(crossingX,crossingY)) { // Wall found or outer
-					distanceY=cachedCos*(crossingX-g_viewerX)+cachedSin*(crossingY-g_viewerY); // calculate distance between points by using transformation of Pythagorean trigonometric identity (faster then sqrt(dx^2+dy^2)).
-			  		finalCrossingFound = true;
+			} else {
+				if (horizontalDistance > maxDistance) break;
+				if (ISCROSSINGSTOP(horizontalX,horizontalY)) { // Wall found or outer
+				 	horizontalOffMap = !ISGRIDINMAP(horizontalX,horizontalY);
+					distanceY = cachedCos*(horizontalX-g_viewerX)+cachedSin*(horizontalY-g_viewerY);
+					horizontalDistance = NOCROSSING;
+					if (distanceY + 0.02 < maxDistance) maxDistance = distanceY + 0.02;
 				} else {
-					crossingX+=deltaX;
-					crossingY+=deltaY;
+					horizontalX+=horizontalDeltaX;
+					horizontalY+=horizontalDeltaY;
+					horizontalDistance+=horizontalDeltaDistance;
 				}
-			}			
-		} while (!finalCrossingFound);
+			}
+		}
 	
+		finalCrossingX = verticalX;
+		finalCrossingY = verticalY;
+		offMap = verticalOffMap;
 		if( distanceY < distanceX -0.01){ 
-			finalCrossingX=crossingX; 
-			finalCrossingY=crossingY; 
+			finalCrossingX=horizontalX; 
+			finalCrossingY=horizontalY; 
+			offMap = horizontalOffMap;
 			side = SIDEUPDOWN;
 			minDistance = distanceY;
 		} else if (distanceX < distanceY -0.01) { 
@@ -994,32 +2852,34 @@ void drawRaycast() {
 			side = lastSide;
 		}
 		
-		minDistance= minDistance*cos(M_PI*(g_viewerAngle-angle)/180); //fisheye fix 
+		minDistance= minDistance*cachedFishEyeCos; //fisheye fix 
 		darken = 1+minDistance/10; // darken wall if far away
 
-		// Color for 2D lines or faces without textures
-		switch (side) {
-			case SIDEUPDOWN: glColor3f(1/darken,0,0); break;
-			case SIDELEFTRIGHT: glColor3f(0,1/darken,0); break;
-			case SIDEUNKNOWN: glColor3f(0,0,0); break; // when first ray is not clear to decide	
+		// Color for 2D lines or faces without textures (no OpenGL calls for the CPU framebuffer in fullscreen, e.g. headless)
+		if (!g_useFrameBuffer || !g_fullScreenMode) {
+			switch (side) {
+				case SIDEUPDOWN: glColor3f(1/darken,0,0); break;
+				case SIDELEFTRIGHT: glColor3f(0,1/darken,0); break;
+				case SIDEUNKNOWN: glColor3f(0,0,0); break; // when first ray is not clear to decide	
+			}
 		}
 			
 		if (!g_fullScreenMode) {
 	  		// line from viewer to crossing point
 			glLineWidth(1);
 			glBegin(GL_LINES);
-			glVertex2i(g_viewerX*GRIDSIZE,g_viewerY*GRIDSIZE);
-			glVertex2i(finalCrossingX*GRIDSIZE,finalCrossingY*GRIDSIZE);
+			glVertex2i(g_viewerX*g_gridSize,g_viewerY*g_gridSize);
+			glVertex2i(finalCrossingX*g_gridSize,finalCrossingY*g_gridSize);
 			glEnd();
 
 			// Point on crossing point
 			glPointSize(1);
 			glBegin(GL_POINTS);
-			glVertex2i(finalCrossingX*GRIDSIZE,finalCrossingY*GRIDSIZE);
+			glVertex2i(finalCrossingX*g_gridSize,finalCrossingY*g_gridSize);
 			glEnd();			
 		}	
 		
-		if (!horizontalOffMap || !verticalOffMap) { // wall found
+		if (!offMap) { // wall found
 			// wall
 		
 			// current height of wall stripe (smaller if far away)			
@@ -1030,7 +2890,7 @@ void drawRaycast() {
       		g_zBuffer[viewPortX] = minDistance;
 
 			// texture pixel height is proportional to max/real wall stripe height
-			deltaY = (double) TEXTURESIZE/(height-1);
+			deltaY = (double) g_textureSize/(height-1);
 			double offsetTextureY = 0;
 			if(height>g_viewPort3dHeight) { // Bigger than viewer port
 				offsetTextureY=(height-g_viewPort3dHeight)/2.0; // half of "oversize"
@@ -1041,57 +2901,60 @@ void drawRaycast() {
 			double textureY = offsetTextureY*deltaY; // line in texture and take care of "oversize" to avoid glitches
 		
 			if (g_showTextures) {
-				texture = (g_wallMap[(int)finalCrossingY][(int)finalCrossingX]); // Nr. of texture
+				texture = (MAPCELL(g_wallMap,(int)finalCrossingX,(int)finalCrossingY)); // Nr. of texture
 				
 				if (side == SIDELEFTRIGHT) { // if horizontal wall face => calc texture column from crossing y value MOD wall width and fix column direction dependent on left/right
-					textureX =(int)(finalCrossingY*TEXTURESIZE)%TEXTURESIZE; // column in texture
-					if(angle<90 || angle>270) textureX=TEXTURESIZE-1-textureX; // flip if needed
+					textureX =(int)(finalCrossingY*g_textureSize)%g_textureSize; // column in texture
+					if(cachedCos > 0) textureX=g_textureSize-1-textureX; // flip if needed (angle<90 or angle>270)
 				}	
 				if (side == SIDEUPDOWN) { // if vertical wall face => calc texture column from crossing x value MOD wall height and fix column direction dependent on up/down
-					textureX=(int)(finalCrossingX*TEXTURESIZE)%TEXTURESIZE; // column in texture
-					if(angle>180) textureX=TEXTURESIZE-1-textureX; // flip if needed
+					textureX=(int)(finalCrossingX*g_textureSize)%g_textureSize; // column in texture
+					if(cachedSin < 0) textureX=g_textureSize-1-textureX; // flip if needed (angle>180)
 				}
 
-				glPointSize(g_pixelSize);
-				glBegin(GL_POINTS);
+				light = g_lightTable[lightLevel(darken,side == SIDEUPDOWN)];
+				int mipLevel = wallMipLevel(height);
+				const unsigned int *textureColumn = TEXTUREMIPCOLUMN(mipLevel,texture-1,((g_textureSize-(int)(textureX)%g_textureSize-1) & (g_textureSize-1)) >> mipLevel);
+				beginPixels();
 				for (int k=0;k<height;k++) {
 					// get color from texture
-					int pixel = ((int)(textureY)%TEXTURESIZE)*TEXTURESIZE*3 + (TEXTURESIZE-(int)(textureX)%TEXTURESIZE-1)*3;
-					if (getTextureColor(texture-1, side == SIDEUPDOWN, pixel, darken, red, green, blue)) {
-						glColor3ub(red,green,blue); 
-						glVertex2i(g_viewPort3dOffsetX + viewPortX*g_pixelSize+g_pixelOffset,k*g_pixelSize + beginOfStripe*g_pixelSize+g_pixelOffset);
+					if (getTextureColor(texture-1, textureColumn[((int)(textureY)%g_textureSize) >> mipLevel], light, red, green, blue)) {
+						drawPixel(viewPortX,k+beginOfStripe,red,green,blue);
 					} else { // special case, when wall point is transparent
 						if (k + beginOfStripe >= g_viewPort3dHalfHeight) {
 							// ground
-							float backgroundDarken = 1+100/(((k+beginOfStripe)-g_viewPort3dHalfHeight) * cachedFishEyeCos * g_pixelSize);
+							const unsigned char *backgroundLight = g_lightTable[lightLevel(1+100/(((k+beginOfStripe)-g_viewPort3dHalfHeight) * cachedFishEyeCos * g_pixelSize))];
 
 							if (g_showBackground) {
-								int pixel=(((g_pixelSize*(k + beginOfStripe)/SKYSCALE)%TEXTURESIZE)*TEXTURESIZE+(textureSkyGroundOffsetStatic+(int) (viewPortX*g_textureSkyGroundStepX))%TEXTURESIZE)*3;
+								int pixel=((((int) (g_pixelSize*(k + beginOfStripe)/SKYSCALE))%g_textureSize)*g_textureSize+(textureSkyGroundOffsetStatic+(int) (viewPortX*g_textureSkyGroundStepX))%g_textureSize)*3;
 								int red   =g_textures[TEXTUREGROUND][pixel+0];
 								int green =g_textures[TEXTUREGROUND][pixel+1];
 								int blue  =g_textures[TEXTUREGROUND][pixel+2];
-			
-								glColor3ub(red/backgroundDarken,green/backgroundDarken,blue/backgroundDarken);
-								glVertex2i(g_viewPort3dOffsetX + viewPortX*g_pixelSize+g_pixelOffset,k*g_pixelSize + beginOfStripe*g_pixelSize+g_pixelOffset);
+	 
+								drawPixel(viewPortX,k+beginOfStripe,backgroundLight[red],backgroundLight[green],backgroundLight[blue]);
 							} 
 						} else {
 							// sky
-							float backgroundDarken = 1+100/((g_viewPort3dHalfHeight-(k+beginOfStripe)) * cachedFishEyeCos * g_pixelSize);
+							const unsigned char *backgroundLight = g_lightTable[lightLevel(1+100/((g_viewPort3dHalfHeight-(k+beginOfStripe)) * cachedFishEyeCos * g_pixelSize))];
 							if (g_showBackground) {
-								int pixel=(((g_pixelSize*(k + beginOfStripe)/SKYSCALE)%TEXTURESIZE)*TEXTURESIZE+(textureSkyGroundOffsetAutoRotate+(int) (viewPortX*g_textureSkyGroundStepX))%TEXTURESIZE)*3;
+								int pixel=((((int) (g_pixelSize*(k + beginOfStripe)/SKYSCALE))%g_textureSize)*g_textureSize+(textureSkyGroundOffsetAutoRotate+(int) (viewPortX*g_textureSkyGroundStepX))%g_textureSize)*3;
 								int red   =g_textures[TEXTURESKY][pixel+0];
 								int green =g_textures[TEXTURESKY][pixel+1];
 								int blue  =g_textures[TEXTURESKY][pixel+2];
 			
-								glColor3ub(red/backgroundDarken,green/backgroundDarken,blue/backgroundDarken);
-								glVertex2i(g_viewPort3dOffsetX + viewPortX*g_pixelSize+g_pixelOffset,k*g_pixelSize + beginOfStripe*g_pixelSize+g_pixelOffset);
-
+								drawPixel(viewPortX,k+beginOfStripe,backgroundLight[red],backgroundLight[green],backgroundLight[blue]);
 							} 
 						}			
 					}
 					textureY += deltaY;	// Next texture line
 				}
-				glEnd();
+				endPixels();
+			} else if (g_useFrameBuffer) {
+				switch (side) {
+					case SIDEUPDOWN: fillFrameBufferColumn(viewPortX,beginOfStripe,beginOfStripe+height,RGBA(255/darken,0,0)); break;
+					case SIDELEFTRIGHT: fillFrameBufferColumn(viewPortX,beginOfStripe,beginOfStripe+height,RGBA(0,255/darken,0)); break;
+					case SIDEUNKNOWN: fillFrameBufferColumn(viewPortX,beginOfStripe,beginOfStripe+height,RGBA(0,0,0)); break;
+				}
 			} else {
 				glLineWidth(g_pixelSize);
 				glBegin(GL_LINES);
@@ -1107,12 +2970,11 @@ void drawRaycast() {
 			lastSide = SIDEUNKNOWN;
 		}
 	
-		// record strip which is nearest to viewer angle
-		if (abs((g_viewerAngle-angle)*100) < centerAngleDiff) {
+		// record strip in viewer direction
+		if (viewPortX == (g_viewPort3dWidth-1)/2) {
 			centerCrossingX = finalCrossingX;
 			centerCrossingY = finalCrossingY;
 			centerCrossingI = viewPortX;
-			centerAngleDiff = abs((g_viewerAngle-angle)*100);
 		}
 
 		// sky, ground, floor and roof
@@ -1121,106 +2983,105 @@ void drawRaycast() {
 				deltaY=viewPortY - g_viewPort3dHalfHeight;
 				if (cachedFishEyeCos == 0) cachedFishEyeCos == 0.00001; // prevent DIV0
 				// Texture X/Y = viewer + Cos/Sin(angle)*HalfScreen*TextureSize/ProjectionDepth/FishEyeCosFix
-				textureX=(double) g_viewerX*TEXTURESIZE + TEXTURESIZE*cachedCos*(g_viewPort3dHalfHeight-5)/(deltaY*cachedFishEyeCos);
-				textureY=g_viewerY*TEXTURESIZE + cachedSin*(g_viewPort3dHalfHeight-5)*TEXTURESIZE/deltaY/cachedFishEyeCos;
+				textureX=(double) g_viewerX*g_textureSize + g_textureSize*cachedCos*(g_viewPort3dHalfHeight-5)/(deltaY*cachedFishEyeCos);
+				textureY=g_viewerY*g_textureSize + cachedSin*(g_viewPort3dHalfHeight-5)*g_textureSize/deltaY/cachedFishEyeCos;
 				darken = 1+100/(deltaY * cachedFishEyeCos * g_pixelSize);
+				light = g_lightTable[lightLevel(darken)];
 
-				glPointSize(g_pixelSize);
-				glBegin(GL_POINTS);				
+				beginPixels();
 	
-				isInMap = ISGRIDINMAP((int)(textureX/TEXTURESIZE),(int)(textureY/TEXTURESIZE));
+				isInMap = (deltaY > 0) && ISGRIDINMAP((int)(textureX/g_textureSize),(int)(textureY/g_textureSize)); // horizon row (below walls of height 0) is infinitely far
 				 
 				if (isInMap) {
 					// floor
-					texture = g_floorMap[((int)textureY)/TEXTURESIZE][((int)textureX)/TEXTURESIZE];
+					texture = MAPCELL(g_floorMap,((int)textureX)/g_textureSize,((int)textureY)/g_textureSize);
 
 			  		if (g_showTextures && g_showBackgroundTexture) {		
-						pixel = ((int)(textureY)&(TEXTURESIZE-1))*TEXTURESIZE*3 + ((int)(textureX)&(TEXTURESIZE-1))*3;
+						pixel = ((int)(textureY)&(g_textureSize-1))*g_textureSize*3 + ((int)(textureX)&(g_textureSize-1))*3;
 										
 						if (texture > 0) {
 							red = g_textures[texture-1][pixel];
 							green = g_textures[texture-1][pixel + 1];
 							blue = g_textures[texture-1][pixel + 2];
 			
-							glColor3ub(red/darken,green/darken,blue/darken);
-							glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,viewPortY*g_pixelSize+g_pixelOffset);
+							drawPixel(viewPortX,viewPortY,light[red],light[green],light[blue]);
 						}
 					} else {
 						// floor
-						if (g_floorMap[((int)textureY)/TEXTURESIZE][((int)textureX)/TEXTURESIZE] > 0 ) {
-							glColor3ub(255/darken,0,255/darken);
-							glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,viewPortY*g_pixelSize+g_pixelOffset);
+						if (MAPCELL(g_floorMap,((int)textureX)/g_textureSize,((int)textureY)/g_textureSize) > 0 ) {
+							drawPixel(viewPortX,viewPortY,light[255],0,light[255]);
 						}
 					}
 				}
 				// Ground
 				if (!isInMap || (texture == 0 )) {
 					if (g_showTextures) {
-						int pixel=(((g_pixelSize*viewPortY/SKYSCALE)%TEXTURESIZE)*TEXTURESIZE+(textureSkyGroundOffsetStatic+(int) (viewPortX*g_textureSkyGroundStepX))%TEXTURESIZE)*3;
+						int pixel=((((int) (g_pixelSize*viewPortY/SKYSCALE))%g_textureSize)*g_textureSize+(textureSkyGroundOffsetStatic+(int) (viewPortX*g_textureSkyGroundStepX))%g_textureSize)*3;
 						int red   =g_textures[TEXTUREGROUND][pixel+0];
 						int green =g_textures[TEXTUREGROUND][pixel+1];
 						int blue  =g_textures[TEXTUREGROUND][pixel+2];
-						glColor3ub(red/darken,green/darken,blue/darken);
-					} else glColor3ub(0,255/darken,255/darken);
-					glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,viewPortY*g_pixelSize+g_pixelOffset);
+						drawPixel(viewPortX,viewPortY,light[red],light[green],light[blue]);
+					} else drawPixel(viewPortX,viewPortY,0,light[255],light[255]);
 				}
 				// Roof
 				if (isInMap) {
-					texture = g_defaultRoofMap[(int)(textureY/TEXTURESIZE)][(int)(textureX/TEXTURESIZE)];
+					texture = MAPCELL(g_roofMap,(int)(textureX/g_textureSize),(int)(textureY/g_textureSize));
 			  		if (g_showTextures && g_showBackgroundTexture) {		
 						if (texture > 0) {
 							red = g_textures[texture-1][pixel];
 							green = g_textures[texture-1][pixel + 1];
 							blue = g_textures[texture-1][pixel + 2];
 
-							glColor3ub(red/darken,green/darken,blue/darken);
-							glVertex2i(g_viewPort3dOffsetX+viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHeight-1)*g_pixelSize-viewPortY*g_pixelSize+g_pixelOffset);
+							drawPixel(viewPortX,g_viewPort3dHeight-1-viewPortY,light[red],light[green],light[blue]);
 						}	
 					} else {// if no textures for floor and roof
 						// roof
-						if (g_defaultRoofMap[((int)textureY)/TEXTURESIZE][((int)textureX)/TEXTURESIZE] > 0) {
-							glColor3ub(255/darken,255/darken,0);
-							glVertex2i(g_viewPort3dOffsetX + viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHeight-1)*g_pixelSize-viewPortY*g_pixelSize+g_pixelOffset);
+						if (MAPCELL(g_roofMap,((int)textureX)/g_textureSize,((int)textureY)/g_textureSize) > 0) {
+							drawPixel(viewPortX,g_viewPort3dHeight-1-viewPortY,light[255],light[255],0);
 						}	
 					}
 				}
 				// Sky
 				if (!isInMap || (texture == 0 )) {
 					if (g_showTextures) {
-						int pixel=(((g_pixelSize*viewPortY/SKYSCALE)%TEXTURESIZE)*TEXTURESIZE+(textureSkyGroundOffsetAutoRotate+(int) (viewPortX*g_textureSkyGroundStepX))%TEXTURESIZE)*3;
+						int pixel=((((int) (g_pixelSize*viewPortY/SKYSCALE))%g_textureSize)*g_textureSize+(textureSkyGroundOffsetAutoRotate+(int) (viewPortX*g_textureSkyGroundStepX))%g_textureSize)*3;
 						int red   =g_textures[TEXTURESKY][pixel+0];
 						int green =g_textures[TEXTURESKY][pixel+1];
 						int blue  =g_textures[TEXTURESKY][pixel+2];
 		
-						glColor3ub(red/darken,green/darken,blue/darken);
-					} else glColor3ub(0,0,255/darken);
-					glVertex2i(g_viewPort3dOffsetX + viewPortX*g_pixelSize+g_pixelOffset,(g_viewPort3dHeight-1)*g_pixelSize-viewPortY*g_pixelSize+g_pixelOffset);
+						drawPixel(viewPortX,g_viewPort3dHeight-1-viewPortY,light[red],light[green],light[blue]);
+					} else drawPixel(viewPortX,g_viewPort3dHeight-1-viewPortY,0,0,light[255]);
 				}
-				glEnd();
+				endPixels();
 			}
 		}
 	}
 
 	if (!g_fullScreenMode) { // if not in fullscreen mode
 		// Center line
-		glColor3f(1,1,0);
-		glLineWidth(1);
+		if (g_useFrameBuffer) {
+			fillFrameBufferColumn(centerCrossingI,0,g_viewPort3dHeight,RGBA(255,255,0));
+			glColor3f(1,1,0);
+		} else {
+			glColor3f(1,1,0);
+			glLineWidth(1);
 
-		glBegin(GL_LINES);
-		glVertex2i(g_viewPort3dOffsetX + centerCrossingI*g_pixelSize+g_lineOffset,0);
-		glVertex2i(g_viewPort3dOffsetX + centerCrossingI*g_pixelSize+g_lineOffset,g_viewPort3dHeight*g_pixelSize-1);
-		glEnd();
+			glBegin(GL_LINES);
+			glVertex2i(g_viewPort3dOffsetX + centerCrossingI*g_pixelSize+g_lineOffset,0);
+			glVertex2i(g_viewPort3dOffsetX + centerCrossingI*g_pixelSize+g_lineOffset,g_viewPort3dHeight*g_pixelSize-1);
+			glEnd();
+		}
 
 		// line from viewer to center point
 		glBegin(GL_LINES);
-		glVertex2i(g_viewerX*GRIDSIZE,g_viewerY*GRIDSIZE);
-		glVertex2i(centerCrossingX*GRIDSIZE,centerCrossingY*GRIDSIZE);
+		glVertex2i(g_viewerX*g_gridSize,g_viewerY*g_gridSize);
+		glVertex2i(centerCrossingX*g_gridSize,centerCrossingY*g_gridSize);
 		glEnd();
 	
 		// center point
 		glPointSize(4);
 		glBegin(GL_POINTS);
-		glVertex2i(centerCrossingX*GRIDSIZE,centerCrossingY*GRIDSIZE);
+		glVertex2i(centerCrossingX*g_gridSize,centerCrossingY*g_gridSize);
 		glEnd();	
 	}
 }
@@ -1232,9 +3093,9 @@ void drawBitmap(int textureNbr, int posX, int posY, int scale) {
 	glPointSize(scale);
 	glBegin(GL_POINTS);
 
-	for (int x=0;x<TEXTURESIZE;x++) {
-		for (int y=0;y<TEXTURESIZE;y++) {
-			pixel = (y*TEXTURESIZE+x)*3;
+	for (int x=0;x<g_textureSize;x++) {
+		for (int y=0;y<g_textureSize;y++) {
+			pixel = (y*g_textureSize+x)*3;
 			red = g_textures[textureNbr][pixel];
 			green = g_textures[textureNbr][pixel+1];
 			blue = g_textures[textureNbr][pixel+2];
@@ -1254,17 +3115,17 @@ void drawInfos(){
     int pixel, red, green, blue, posX, posY;
 	
 	// Collected sprite items in a smaller size
-	posX = g_viewPort3dOffsetX + g_viewPort3dWidth*g_pixelSize-TEXTURESIZE/TEXTURESYMBOLDIVIDER-1; 
-	posY = g_viewPort3dHeight*g_pixelSize-TEXTURESIZE/TEXTURESYMBOLDIVIDER-1;
+	posX = g_viewPort3dOffsetX + g_viewPort3dWidth*g_pixelSize-g_textureSize/TEXTURESYMBOLDIVIDER-1; 
+	posY = g_viewPort3dHeight*g_pixelSize-g_textureSize/TEXTURESYMBOLDIVIDER-1;
 
 	glPointSize(1);
 	glBegin(GL_POINTS);
 
-	for (int i=0;i<MAXSPRITES;i++) {
+	for (size_t i=0;i<g_sprites.size();i++) {
 		if ((g_sprites[i].type & SPRITECOLLECTION == SPRITECOLLECTION) && g_sprites[i].collected){
-			for (int x=0;x<TEXTURESIZE/TEXTURESYMBOLDIVIDER;x++) {
-				for (int y=0;y<TEXTURESIZE/TEXTURESYMBOLDIVIDER;y++) {
-					pixel = (y*TEXTURESIZE*TEXTURESYMBOLDIVIDER+x*TEXTURESYMBOLDIVIDER)*3;
+			for (int x=0;x<g_textureSize/TEXTURESYMBOLDIVIDER;x++) {
+				for (int y=0;y<g_textureSize/TEXTURESYMBOLDIVIDER;y++) {
+					pixel = (y*g_textureSize*TEXTURESYMBOLDIVIDER+x*TEXTURESYMBOLDIVIDER)*3;
 					red = g_textures[g_sprites[i].texture][pixel];
 					green = g_textures[g_sprites[i].texture][pixel+1];
 					blue = g_textures[g_sprites[i].texture][pixel+2];
@@ -1274,7 +3135,7 @@ void drawInfos(){
 					}
 				}
 			}
-			posX -= TEXTURESIZE/TEXTURESYMBOLDIVIDER;
+			posX -= g_textureSize/TEXTURESYMBOLDIVIDER;
 		}
 	}
 
@@ -1284,7 +3145,8 @@ void drawInfos(){
     if (g_fps == 0) return;
 	
 	if (g_state == STATE_RUNNING) {
-		snprintf(strData,DISPLAYTEXTMAXLENGTH,"%d seconds", (glutGet(GLUT_ELAPSED_TIME)-g_gameStartTime)/1000);	
+		snprintf(strData,DISPLAYTEXTMAXLENGTH,"%d seconds", (getElapsedTime()-g_gameStartTime)/1000);	
+		requestImageChange(g_gameStartTime+((getElapsedTime()-g_gameStartTime)/1000+1)*1000);
 	} else {
 		snprintf(strData,DISPLAYTEXTMAXLENGTH,"%d fps", g_fps);	
 	}
@@ -1294,6 +3156,30 @@ void drawInfos(){
    	glutBitmapString(GLUT_BITMAP_HELVETICA_18, (unsigned char*)strData);
 }
 
+// Show rolling min/avg/p99 of every render stage in the upper left corner of the 3d view
+void drawTimings() {
+	char strData[DISPLAYTEXTMAXLENGTH];
+	double minTime, avgTime, p99Time;
+	void *font = GLUT_BITMAP_8_BY_13;
+
+	if (!g_showTimings) return;
+
+	for (int i=-1;i<=STAGECOUNT;i++) {
+		if (i < 0) snprintf(strData,DISPLAYTEXTMAXLENGTH,"%-10s %7s %7s %7s","ms","min","avg","p99");
+		else {
+			stageStatistics(i,minTime,avgTime,p99Time);
+			snprintf(strData,DISPLAYTEXTMAXLENGTH,"%-10s %7.2f %7.2f %7.2f",(i < STAGECOUNT)?g_stageNames[i]:"frame",minTime,avgTime,p99Time);
+		}
+		// black shadow for readability on bright walls
+		glColor3f(0,0,0);
+		glRasterPos2f(g_viewPort3dOffsetX + 11, 21 + (i+1)*14);
+		glutBitmapString(font, (unsigned char*)strData);
+		glColor3f(1,1,1);
+		glRasterPos2f(g_viewPort3dOffsetX + 10, 20 + (i+1)*14);
+		glutBitmapString(font, (unsigned char*)strData);
+	}
+}
+
 // draw text in the middle of the screen (draw text twice: First black and than white with a little offset)
 void drawCenteredTextLine(int posY,bool smallFont=false) {
     void *font;
@@ -1318,10 +3204,11 @@ void drawMessage(){
 
 	if (g_state== STATE_START) drawBitmap(TEXTURELOGO,g_viewPort3dOffsetX,0,2);
 
-	if (g_displayTextBlinking && ((glutGet(GLUT_ELAPSED_TIME)/1000) & 1)) return; // blink text every 1 second
+	if (g_displayTextBlinking) requestImageChange((getElapsedTime()/1000+1)*1000);
+	if (g_displayTextBlinking && ((getElapsedTime()/1000) & 1)) return; // blink text every 1 second
 
 	if (g_state == STATE_QUIT) { // Quit program state
-		timeDelta = (glutGet(GLUT_ELAPSED_TIME)-g_stateStartTime)/1000;
+		timeDelta = (getElapsedTime()-g_stateStartTime)/1000;
 		if (timeDelta < 0) timeDelta=0;
 		if  (timeDelta > DISPLAYTEXTTIMEOUT) { // Quit program
 			exit(0);
@@ -1427,7 +3314,7 @@ void drawMessage(){
 	
 	drawCenteredTextLine(g_viewPort3dHeight*g_pixelSize/2);
 	
-	if ((g_state == STATE_RUNNING) && (glutGet(GLUT_ELAPSED_TIME)-g_stateStartTime > DISPLAYTEXTTIMEOUT*1000)) { // autohide text in game state after a few seconds
+	if ((g_state == STATE_RUNNING) && (getElapsedTime()-g_stateStartTime > DISPLAYTEXTTIMEOUT*1000)) { // autohide text in game state after a few seconds
 		g_displayText[0]='\0';
     	g_displayTextBlinking = false;
 	}	
@@ -1437,7 +3324,7 @@ void drawMessage(){
 void changeStateToRunning() {
 	if (g_state == STATE_QUIT) return; // not possible in quit program state
 	g_state = STATE_RUNNING;
-	g_stateStartTime = glutGet(GLUT_ELAPSED_TIME);
+	g_stateStartTime = g_simulationTime;
 	g_gameStartTime = g_stateStartTime;
 	snprintf(g_displayText,DISPLAYTEXTMAXLENGTH+1,"Find the exit...");
    	g_displayTextBlinking=false;
@@ -1447,35 +3334,339 @@ void changeStateToRunning() {
 void changeStateToFinished() {
 	if (g_state == STATE_QUIT) return; // not possible in quit program state
 	g_state = STATE_FINISHED;
-	g_stateStartTime = glutGet(GLUT_ELAPSED_TIME);
+	g_stateStartTime = g_simulationTime;
 	g_gameEndTime = g_stateStartTime;
 	g_displayText[0]='\0';
    	g_displayTextBlinking=false;
 }
 
-// Go to start state
-void changeStateToStart() {
+// Build built-in level in binary map format
+void buildBuiltinMap() {
+	size_t layerSize = MAPLAYERSIZE(BUILTINMAPWIDTH,BUILTINMAPHEIGHT);
+	int spriteCount = sizeof(g_builtinSprites)/sizeof(g_builtinSprites[0]);
+
+	g_mapBuffer.assign(sizeof(MapHeader)+3*layerSize+spriteCount*sizeof(MapSprite),0);
+	MapHeader *header = (MapHeader *) &g_mapBuffer[0];
+	memcpy(header->magic,MAPMAGIC,sizeof(header->magic));
+	header->version = MAPVERSION;
+	header->width = BUILTINMAPWIDTH;
+	header->height = BUILTINMAPHEIGHT;
+	header->startX = DEFAULTVIEWERX;
+	header->startY = DEFAULTVIEWERY;
+	header->startAngle = DEFAULTVIEWERANGLE;
+	header->finishX = FINISHX;
+	header->finishY = FINISHY;
+	header->spriteCount = spriteCount;
+
+	unsigned char *layer = &g_mapBuffer[sizeof(MapHeader)];
+	memcpy(layer,g_builtinWallMap,sizeof(g_builtinWallMap));
+	memcpy(layer+layerSize,g_builtinFloorMap,sizeof(g_builtinFloorMap));
+	memcpy(layer+2*layerSize,g_builtinRoofMap,sizeof(g_builtinRoofMap));
+	MapSprite *sprites = (MapSprite *) (layer+3*layerSize);
+	for (int i=0;i<spriteCount;i++) {
+		sprites[i].x = g_builtinSprites[i].x;
+		sprites[i].y = g_builtinSprites[i].y;
+		sprites[i].texture = g_builtinSprites[i].texture;
+		sprites[i].type = g_builtinSprites[i].type;
+		sprites[i].openX = g_builtinSprites[i].openX;
+		sprites[i].openY = g_builtinSprites[i].openY;
+	}
+
+	g_mapData = &g_mapBuffer[0];
+	g_mapDataSize = g_mapBuffer.size();
+}
+
+// Map file into memory (private copy on write, so opened walls never change the file)
+bool mapMapFile() {
+	#ifndef _WIN32
+	struct stat status;
+	int file = open(g_mapFileName,O_RDONLY);
+	if (file < 0) return false;
+	if ((fstat(file,&status) != 0) || (status.st_size == 0)) {
+		close(file);
+		return false;
+	}
+	void *data = mmap(NULL,status.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,file,0);
+	close(file);
+	if (data == MAP_FAILED) return false;
+	g_mapData = (unsigned char *) data;
+	g_mapDataSize = status.st_size;
+	g_mapDataMapped = true;
+	#else // no mmap, read file
+	FILE *file = fopen(g_mapFileName,"rb");
+	if (file == NULL) return false;
+	fseek(file,0,SEEK_END);
+	g_mapBuffer.resize(ftell(file));
+	fseek(file,0,SEEK_SET);
+	bool success = !g_mapBuffer.empty() && (fread(&g_mapBuffer[0],1,g_mapBuffer.size(),file) == g_mapBuffer.size());
+	fclose(file);
+	if (!success) return false;
+	g_mapData = &g_mapBuffer[0];
+	g_mapDataSize = g_mapBuffer.size();
+	#endif
+	return true;
+}
+
+// Check level in binary map format, returns error text or NULL
+const char *checkMap() {
+	const MapHeader *header = (const MapHeader *) g_mapData;
+
+	if ((g_mapDataSize < sizeof(MapHeader)) || (memcmp(header->magic,MAPMAGIC,sizeof(header->magic)) != 0)) return "no map file";
+	if (header->version != MAPVERSION) return "unsupported version";
+	if ((header->width < 3) || (header->width > MAXMAPSIZE) || (header->height < 3) || (header->height > MAXMAPSIZE)) return "invalid map size";
+	size_t layerSize = MAPLAYERSIZE(header->width,header->height);
+	if (g_mapDataSize < sizeof(MapHeader)+3*layerSize+(size_t) header->spriteCount*sizeof(MapSprite)) return "file too short";
+
+	int width = header->width, height = header->height;
+	const MapCell *walls = g_mapData + sizeof(MapHeader);
+	for (int layer=0;layer<3;layer++) {
+		const MapCell *cells = walls + layer*layerSize;
+		MapCell maxCell = 0;
+		for (size_t i=0;i<(size_t) width*height;i++) maxCell = std::max(maxCell,cells[i]);
+		if (maxCell > g_textureCount) return "invalid texture number in map";
+	}
+	for (int x=0;x<width;x++) {
+		if ((walls[x] == 0) || (walls[(height-1)*width+x] == 0)) return "map border without wall";
+	}
+	for (int y=0;y<height;y++) {
+		if ((walls[y*width] == 0) || (walls[y*width+width-1] == 0)) return "map border without wall";
+	}
+	if (!(header->startX > 0) || !(header->startX < width) || !(header->startY > 0) || !(header->startY < height) ||
+		(walls[(int) header->startY*width+(int) header->startX] > 0)) return "invalid start position";
+	if ((header->finishX >= (unsigned int) width) || (header->finishY >= (unsigned int) height)) return "invalid finish cell";
+	const MapSprite *sprites = (const MapSprite *) (g_mapData+sizeof(MapHeader)+3*layerSize);
+	for (unsigned int i=0;i<header->spriteCount;i++) {
+		if ((sprites[i].texture >= g_textureCount) || (sprites[i].openX >= width) || (sprites[i].openY >= height)) return "invalid sprite";
+	}
+	return NULL;
+}
+
+// Load level from map file or built-in level (also restores opened walls and collected sprites), returns false on error
+bool loadLevel() {
+	#ifndef _WIN32
+	if (g_mapDataMapped) munmap(g_mapData,g_mapDataSize);
+	#endif
+	g_mapDataMapped = false;
+	if (g_mapFileName == NULL) buildBuiltinMap();
+	else if (!mapMapFile()) {
+		fprintf(stderr,"Could not read map file %s\n",g_mapFileName);
+		return false;
+	}
+	const char *error = checkMap();
+	if (error != NULL) {
+		fprintf(stderr,"Invalid map file %s: %s\n",g_mapFileName?g_mapFileName:"(built-in)",error);
+		return false;
+	}
+
+	// layers are used in place
+	const MapHeader *header = (const MapHeader *) g_mapData;
+	size_t layerSize = MAPLAYERSIZE(header->width,header->height);
+	g_mapWidth = header->width;
+	g_mapHeight = header->height;
+	g_wallMap = g_mapData + sizeof(MapHeader);
+	g_floorMap = g_wallMap + layerSize;
+	g_roofMap = g_floorMap + layerSize;
+
+	const MapSprite *sprites = (const MapSprite *) (g_roofMap + layerSize);
+	g_sprites.resize(header->spriteCount);
+	for (unsigned int i=0;i<header->spriteCount;i++) {
+		g_sprites[i].x = sprites[i].x;
+		g_sprites[i].y = sprites[i].y;
+		g_sprites[i].texture = sprites[i].texture;
+		g_sprites[i].type = sprites[i].type;
+		g_sprites[i].collected = false;
+		g_sprites[i].openX = sprites[i].openX;
+		g_sprites[i].openY = sprites[i].openY;
+	}
+	buildSpriteGrid();
+	buildSolidGrid();
+
+	g_startViewerX = isnan(g_argViewerX) ? header->startX : g_argViewerX;
+	g_startViewerY = isnan(g_argViewerY) ? header->startY : g_argViewerY;
+	g_startViewerAngle = isnan(g_argViewerAngle) ? header->startAngle : g_argViewerAngle;
+	g_finishX = header->finishX;
+	g_finishY = header->finishY;
+
+	g_gridSize = std::min(GRIDSIZE,MAP2DSIZE/std::max(g_mapWidth,g_mapHeight));
+	if (g_gridSize < MINGRIDSIZE) g_gridSize = 0; // map too large for 2d view
+	g_sceneChanges++;
+	return true;
+}
+
+// Write current level as map file (before any changes by the game), returns false on error
+bool saveMap(const char *fileName) {
+	FILE *file = fopen(fileName,"wb");
+	if (file == NULL) return false;
+	bool success = (fwrite(g_mapData,1,g_mapDataSize,file) == g_mapDataSize);
+	if (fclose(file) != 0) success = false;
+	return success;
+}
+
+// Get modification time and size of file, returns false on error
+bool getFileStatus(const char *fileName, time_t &modified, long long &size) {
+	struct stat status;
+	if (stat(fileName,&status) != 0) return false;
+	modified = status.st_mtime;
+	size = status.st_size;
+	return true;
+}
+
+// Map texture pack file into memory (read only). A watched file is read instead, because a mapped file rewritten in place would change under the renderer.
+bool mapTexturePackFile(TexturePack &pack) {
+	pack.data = NULL;
+	pack.size = 0;
+	pack.mapped = false;
+	#ifndef _WIN32
+	if (!g_watchTexturePack) {
+		struct stat status;
+		int file = open(g_texturePackFileName,O_RDONLY);
+		if (file < 0) return false;
+		if ((fstat(file,&status) != 0) || (status.st_size == 0)) {
+			close(file);
+			return false;
+		}
+		void *data = mmap(NULL,status.st_size,PROT_READ,MAP_PRIVATE,file,0);
+		close(file);
+		if (data == MAP_FAILED) return false;
+		pack.data = (const unsigned char *) data;
+		pack.size = status.st_size;
+		pack.mapped = true;
+		return true;
+	}
+	#endif
+	FILE *file = fopen(g_texturePackFileName,"rb");
+	if (file == NULL) return false;
+	fseek(file,0,SEEK_END);
+	pack.buffer.resize(ftell(file));
+	fseek(file,0,SEEK_SET);
+	bool success = !pack.buffer.empty() && (fread(&pack.buffer[0],1,pack.buffer.size(),file) == pack.buffer.size());
+	fclose(file);
+	if (!success) return false;
+	pack.data = &pack.buffer[0];
+	pack.size = pack.buffer.size();
+	return true;
+}
+
+// Release memory of texture pack file
+void unmapTexturePackFile(TexturePack &pack) {
+	#ifndef _WIN32
+	if (pack.mapped) munmap((void *) pack.data,pack.size);
+	#endif
+	pack.buffer.clear();
+	pack.data = NULL;
+	pack.size = 0;
+	pack.mapped = false;
+}
+
+// Check texture pack, returns error text or NULL
+const char *checkTexturePack(const TexturePack &pack) {
+	const TexturePackHeader *header = (const TexturePackHeader *) pack.data;
+
+	if ((pack.size < sizeof(TexturePackHeader)) || (memcmp(header->magic,TEXTUREPACKMAGIC,sizeof(header->magic)) != 0)) return "no texture pack file";
+	if (header->version != TEXTUREPACKVERSION) return "unsupported version";
+	if ((header->textureSize < 2) || (header->textureSize > MAXTEXTURESIZE) || ((header->textureSize & (header->textureSize-1)) != 0)) return "invalid texture size";
+	for (size_t i=0;i<sizeof(g_roleTextures)/sizeof(g_roleTextures[0]);i++) {
+		if (header->textureCount <= (unsigned int) g_roleTextures[i]) return "too few textures";
+	}
+	if ((unsigned long long) header->textureCount*header->textureSize*header->textureSize > MAXTEXTURETEXELS) return "too many texels";
+	if (pack.size < sizeof(TexturePackHeader)+(size_t) header->textureCount*header->textureSize*header->textureSize*3) return "file too short";
+	return NULL;
+}
+
+// Use textures of texture pack in place
+void useTexturePack(const TexturePack &pack) {
+	const TexturePackHeader *header = (const TexturePackHeader *) pack.data;
+	size_t textureBytes = (size_t) header->textureSize*header->textureSize*3;
+
+	g_textureSize = header->textureSize;
+	g_textureCount = header->textureCount;
+	g_textures.resize(g_textureCount);
+	for (int i=0;i<g_textureCount;i++) g_textures[i] = pack.data + sizeof(TexturePackHeader) + i*textureBytes;
+}
+
+// Load textures from texture pack file or use built-in textures, returns false on error
+bool loadTextures() {
+	if (g_texturePackFileName == NULL) {
+		g_textureSize = TEXTURESIZE;
+		g_textureCount = sizeof(g_builtinTextures)/sizeof(g_builtinTextures[0]);
+		g_textures.resize(g_textureCount);
+		for (int i=0;i<g_textureCount;i++) g_textures[i] = g_builtinTextures[i];
+		return true;
+	}
+	if (!getFileStatus(g_texturePackFileName,g_texturePackModified,g_texturePackFileSize) || !mapTexturePackFile(g_texturePack)) {
+		fprintf(stderr,"Could not read texture pack file %s\n",g_texturePackFileName);
+		return false;
+	}
+	const char *error = checkTexturePack(g_texturePack);
+	if (error != NULL) {
+		fprintf(stderr,"Invalid texture pack file %s: %s\n",g_texturePackFileName,error);
+		return false;
+	}
+	useTexturePack(g_texturePack);
+	return true;
+}
+
+// Reload texture pack when the file has changed (the current textures stay on errors), returns true when reloaded
+bool checkTexturePackChange() {
+	time_t modified;
+	long long size;
+	TexturePack pack;
+
+	if (!g_watchTexturePack || (g_texturePackFileName == NULL)) return false;
+	if (!getFileStatus(g_texturePackFileName,modified,size)) return false; // file is being replaced
+	if ((modified == g_texturePackModified) && (size == g_texturePackFileSize)) return false;
+	g_texturePackModified = modified; // report errors only once per change
+	g_texturePackFileSize = size;
+
+	if (!mapTexturePackFile(pack)) {
+		fprintf(stderr,"Could not read texture pack file %s\n",g_texturePackFileName);
+		return false;
+	}
+	const char *error = checkTexturePack(pack);
+	if ((error == NULL) && (((const TexturePackHeader *) pack.data)->textureCount < (unsigned int) g_textureCount)) error = "fewer textures than loaded texture pack"; // level was checked against loaded textures
+	if (error != NULL) {
+		fprintf(stderr,"Invalid texture pack file %s: %s\n",g_texturePackFileName,error);
+		unmapTexturePackFile(pack);
+		return false;
+	}
+	std::swap(g_texturePack,pack);
+	unmapTexturePackFile(pack); // textures of previous texture pack
+	useTexturePack(g_texturePack);
+	prepareTextures();
+	return true;
+}
+
+// Write built-in textures as texture pack file (start for own texture packs), returns false on error
+bool saveTextures(const char *fileName) {
+	TexturePackHeader header;
+	memcpy(header.magic,TEXTUREPACKMAGIC,sizeof(header.magic));
+	header.version = TEXTUREPACKVERSION;
+	header.textureSize = TEXTURESIZE;
+	header.textureCount = sizeof(g_builtinTextures)/sizeof(g_builtinTextures[0]);
+
+	FILE *file = fopen(fileName,"wb");
+	if (file == NULL) return false;
+	bool success = (fwrite(&header,sizeof(header),1,file) == 1) && (fwrite(g_builtinTextures,sizeof(g_builtinTextures),1,file) == 1);
+	if (fclose(file) != 0) success = false;
+	return success;
+}
+
+// Go to start state
+void changeStateToStart() {
 	if (g_state == STATE_QUIT) return; // not possible in quit program state
 	g_state = STATE_START;
-	g_stateStartTime = glutGet(GLUT_ELAPSED_TIME);
+	g_stateStartTime = g_simulationTime;
 	snprintf(g_displayText,DISPLAYTEXTMAXLENGTH+1,"Insert coins...");
    	g_displayTextBlinking=true;
    	g_gameStartTime = 0;
    	
-   	// Reset sprites
-   	for (int i=0;i<MAXSPRITES;i++) g_sprites[i].collected=false;
+   	// Reset walls, floor and sprites
+   	if (!loadLevel()) exit(1);
 
    	// Reset viewer
-	g_viewerX = DEFAULTVIEWERX;
-	g_viewerY = DEFAULTVIEWERY;
-	g_viewerAngle = DEFAULTVIEWERANGLE;
-	// Reset walls and floor
-	for (int i=0;i<MAPHEIGHT;i++) {
-		for (int j=0;j<MAPWIDTH;j++) {
-			g_wallMap[i][j] = g_defaultWallMap[i][j];
-			g_floorMap[i][j] = g_defaultFloorMap[i][j];
-		}
-	}
+	g_viewerX = g_startViewerX;
+	g_viewerY = g_startViewerY;
+	g_viewerAngle = g_startViewerAngle;
 	// Reset input
 	g_buttonUpPressed = false;
 	g_buttonDownPressed = false;
@@ -1494,17 +3685,19 @@ void changeStateToStart() {
 // Go to quit program state
 void changeStateToQuit() {
 	g_state = STATE_QUIT;
-	g_stateStartTime = glutGet(GLUT_ELAPSED_TIME);
+	g_stateStartTime = g_simulationTime;
 	g_displayText[0]='\0';
    	g_displayTextBlinking=false;
 }
 
 // Calculate viewport and offset dependent on real display- and pixelsize
 void recalcDisplayProperties() {
+	if (!g_useFrameBuffer) g_pixelSize = ceilf(g_pixelSize); // OpenGL points need whole pixel sizes
 	g_viewPort3dWidth = g_viewPort3dPhysicalWidth / g_pixelSize ;
 	if (g_viewPort3dWidth > MAXWIDTH) g_viewPort3dWidth = MAXWIDTH;
 
 	g_viewPort3dHeight = g_viewPort3dPhysicalHeight / g_pixelSize;
+	if (g_viewPort3dHeight > MAXHEIGHT) g_viewPort3dHeight = MAXHEIGHT;
 	if (g_viewPort3dHeight & 1) g_viewPort3dHeight--; // always odd to avoid glitches
     g_viewPort3dHalfHeight = g_viewPort3dHeight/2;
 
@@ -1512,6 +3705,88 @@ void recalcDisplayProperties() {
 	g_lineOffset = (g_pixelSize)/2;
 	
 	g_textureSkyGroundStepX = (float) g_pixelSize/SKYSCALE;
+
+	g_frameBuffer.resize(g_viewPort3dWidth*g_viewPort3dHeight);
+	prepareRayAngleTables();
+	prepareCameraTableFixed();
+}
+
+// Adjust pixel size after every frame, so the frame time stays within g_frameTimeBudget. Frame time is about proportional to the pixel count (1/pixelSize^2).
+// Expensive frames are followed quickly, cheap frames slowly. Between 75% and 100% of the budget the pixel size is kept to prevent hunting.
+void updatePixelSize(double frameTime) {
+	if (g_smoothedFrameTime == 0) g_smoothedFrameTime = frameTime;
+	g_smoothedFrameTime += ((frameTime > g_smoothedFrameTime) ? 0.3 : 0.1)*(frameTime - g_smoothedFrameTime);
+
+	bool coarser = (g_smoothedFrameTime > g_frameTimeBudget);
+	if (!coarser && (g_smoothedFrameTime > 0.75*g_frameTimeBudget)) return;
+
+	float step = g_useFrameBuffer ? PIXELSIZESTEP : 1; // OpenGL points need whole pixel sizes
+	float pixelSize = g_pixelSize*sqrt(g_smoothedFrameTime/(0.9*g_frameTimeBudget)); // aims at 90% of budget
+	if (coarser) {
+		pixelSize = std::min(pixelSize,g_pixelSize*1.5f);
+		pixelSize = ceilf(pixelSize/step)*step; // rounded up to stay within budget
+	} else {
+		pixelSize = std::max(pixelSize,g_pixelSize*0.9f); // finer by about 10% per frame
+		pixelSize = std::min(floorf(pixelSize/step)*step,g_pixelSize-step); // rounded down, at least one step
+		if (g_smoothedFrameTime*(g_pixelSize*g_pixelSize)/(pixelSize*pixelSize) > g_frameTimeBudget) return; // finer size would be over budget
+	}
+	pixelSize = std::min(std::max(pixelSize,1.0f),(float) MAXPIXELSIZE);
+	if (pixelSize == g_pixelSize) return;
+
+	g_smoothedFrameTime *= (g_pixelSize*g_pixelSize)/(pixelSize*pixelSize); // expected frame time for new pixel size
+	g_pixelSize = pixelSize;
+	recalcDisplayProperties();
+}
+
+// Timer for next frame (only latest timer counts)
+void frameTimer(int generation) {
+	if (generation != g_frameTimerGeneration) return;
+	g_scheduledFrameTime = -1;
+	glutPostRedisplay();
+}
+
+// Schedule next frame at time, but not before frame rate cap allows (an earlier scheduled frame wins)
+void scheduleFrame(int time) {
+	if (g_targetFps > 0) time = std::max(time,(int) ceil(g_nextFrameTime));
+	if ((g_scheduledFrameTime >= 0) && (g_scheduledFrameTime <= time)) return;
+	g_scheduledFrameTime = time;
+	g_frameTimerGeneration++;
+	glutTimerFunc(std::max(time - getElapsedTime(),0),frameTimer,g_frameTimerGeneration);
+}
+
+// Redraw as soon as possible after input or changed settings (leaves idle mode)
+void requestRedraw() {
+	scheduleFrame(getElapsedTime());
+}
+
+// Any button, joystick or mouse input which changes the viewer every frame?
+bool isInputActive() {
+	return g_buttonUpPressed || g_buttonDownPressed || g_buttonLeftPressed || g_buttonRightPressed ||
+		g_joystickForward || g_joystickBackward || g_joystickLeft || g_joystickRight ||
+		g_mouseForward || g_mouseBackward || g_mouseLeft || g_mouseRight;
+}
+
+// Enable or disable waiting for vertical retrace on buffer swap (if supported by OpenGL driver)
+void setVSync(bool on) {
+	#ifdef _WIN32
+	typedef BOOL (WINAPI *SwapIntervalFunction)(int);
+	SwapIntervalFunction swapInterval = (SwapIntervalFunction) wglGetProcAddress("wglSwapIntervalEXT");
+	if (swapInterval != NULL) swapInterval(on ? 1 : 0);
+	#else
+	Display *display = glXGetCurrentDisplay();
+	if (display == NULL) return;
+	const char *extensions = glXQueryExtensionsString(display,DefaultScreen(display));
+	if (extensions == NULL) return;
+	if (strstr(extensions,"GLX_EXT_swap_control") != NULL) {
+		typedef void (*SwapIntervalFunction)(Display *, GLXDrawable, int);
+		SwapIntervalFunction swapInterval = (SwapIntervalFunction) glXGetProcAddressARB((const GLubyte *) "glXSwapIntervalEXT");
+		if (swapInterval != NULL) swapInterval(display,glXGetCurrentDrawable(),on ? 1 : 0);
+	} else if (strstr(extensions,"GLX_MESA_swap_control") != NULL) {
+		typedef int (*SwapIntervalFunction)(unsigned int);
+		SwapIntervalFunction swapInterval = (SwapIntervalFunction) glXGetProcAddressARB((const GLubyte *) "glXSwapIntervalMESA");
+		if (swapInterval != NULL) swapInterval(on ? 1 : 0);
+	}
+	#endif
 }
 
 // Resize window
@@ -1519,7 +3794,7 @@ void resize(int w, int h) {
 	g_windowWidth = w;
 	g_windowHeight = h;
 
-	if (g_windowHeight < MAPHEIGHT*GRIDSIZE) g_windowHeight = MAPHEIGHT*GRIDSIZE;	
+	if (g_windowHeight < g_mapHeight*g_gridSize) g_windowHeight = g_mapHeight*g_gridSize;	
 
 	g_viewPort3dPhysicalHeight = g_windowHeight;
 
@@ -1527,10 +3802,10 @@ void resize(int w, int h) {
 		g_viewPort3dPhysicalWidth = g_windowWidth;
 	} else {
 		if (g_viewPort3dPhysicalHeight & 1) g_viewPort3dPhysicalHeight--; // odd height 
-		g_viewPort3dPhysicalWidth = g_windowWidth - GRIDSIZE*MAPWIDTH;
+		g_viewPort3dPhysicalWidth = g_windowWidth - g_gridSize*g_mapWidth;
 		if (g_viewPort3dPhysicalWidth < MINVIEWPORT3DWIDTH) {
 			g_viewPort3dPhysicalWidth = MINVIEWPORT3DWIDTH;
-			g_windowWidth = g_viewPort3dPhysicalWidth + GRIDSIZE*MAPWIDTH;
+			g_windowWidth = g_viewPort3dPhysicalWidth + g_gridSize*g_mapWidth;
 		}
 	}
 
@@ -1545,22 +3820,22 @@ void resize(int w, int h) {
 }
 
 // Common key pressed
-void keyboard(unsigned char key,int x,int y)
+void handleKey(unsigned char key)
 {
 	// start game on first key pressed
 	if (g_state == STATE_START) changeStateToRunning();
 	
 	// Reset timeout in quit program state 
-	if (g_state == STATE_QUIT) g_stateStartTime = glutGet(GLUT_ELAPSED_TIME);
+	if (g_state == STATE_QUIT) g_stateStartTime = g_simulationTime;
 
     switch(key) {
     	// pixel size
     	case 's': // down
-    		if (g_pixelSize>1) g_pixelSize--;
+    		g_pixelSize = std::max(ceilf(g_pixelSize)-1,1.0f);
 			recalcDisplayProperties();
     		break;
     	case 'S': // up
-    		if (g_pixelSize < 16) g_pixelSize ++;
+    		g_pixelSize = std::min(floorf(g_pixelSize)+1,(float) MAXPIXELSIZE);
 			recalcDisplayProperties();
     		break;
     	case '1': // textures for roof and floor on/off
@@ -1569,16 +3844,33 @@ void keyboard(unsigned char key,int x,int y)
     	case '2': // toggle sky texture
     		g_showBackground = !g_showBackground;
     		break;
-    	case '3': // DDA raycaster or my old raycaster
-    		g_oldStyle = !g_oldStyle;
+    	case '3': // DDA raycaster, my old raycaster or fixed point DDA raycaster
+    		g_engine = (g_engine+1) % ENGINECOUNT;
     		break;
     	case '4': // toggle round pixels
+    		if (g_headless) break; // needs OpenGL
     		g_roundPixels = !g_roundPixels;
+    		if (g_roundPixels) g_useFrameBuffer = false; // round pixels are only possible with OpenGL points
 			recalcDisplayProperties();
     		break;
     	case '5': // toggle automatic pixel size function
     		g_autoPixelSize = !g_autoPixelSize;
     		break;
+    	case '6': // toggle CPU framebuffer
+    		if (g_headless) break; // needs OpenGL
+    		g_useFrameBuffer = !g_useFrameBuffer;
+    		if (g_useFrameBuffer) g_roundPixels = false;
+			recalcDisplayProperties();
+    		break;
+    	case '7': // toggle mipmaps
+    		g_useMipmaps = !g_useMipmaps;
+    		break;
+    	case '8': // toggle frame timing overlay
+    		g_showTimings = !g_showTimings;
+    		break;
+    	case '9': // toggle frame reuse
+    		g_reuseFrames = !g_reuseFrames;
+    		break;
     	// toggle textures on/off
     	case 't':
     	case 'T':
@@ -1587,13 +3879,14 @@ void keyboard(unsigned char key,int x,int y)
     	// toggle fullscreen on/off
     	case 'f':
     	case 'F': {
+    		if ((g_gridSize == 0) || g_headless) break; // map too large for 2d view or no window
     		if (g_fullScreenMode) {
     			g_fullScreenMode = false;
     			glutPositionWindow(0,0);
 				glutReshapeWindow(g_savedWindowWidth, g_savedWindowHeight);
 				g_windowWidth = glutGet(GLUT_WINDOW_WIDTH);
 				g_windowHeight = glutGet(GLUT_WINDOW_HEIGHT);
-				g_viewPort3dOffsetX = MAPWIDTH*GRIDSIZE;
+				g_viewPort3dOffsetX = g_mapWidth*g_gridSize;
 			} else {
 				g_fullScreenMode = true;
 				g_savedWindowWidth = glutGet(GLUT_WINDOW_WIDTH);
@@ -1614,10 +3907,10 @@ void keyboard(unsigned char key,int x,int y)
 }
 
 // Special key pressed
-void specialButtonPressed(int key, int x, int y) {
+void handleSpecialButtonPressed(int key) {
 
 	// Reset timeout in quit program state 
-	if (g_state == STATE_QUIT) g_stateStartTime = glutGet(GLUT_ELAPSED_TIME);
+	if (g_state == STATE_QUIT) g_stateStartTime = g_simulationTime;
 	
 	// start game on first keypress
 	if (g_state == STATE_START) changeStateToRunning();
@@ -1631,7 +3924,7 @@ void specialButtonPressed(int key, int x, int y) {
 }
 
 // Special key released
-void specialButtonReleased(int key, int x, int y) {
+void handleSpecialButtonReleased(int key) {
 	switch (key) {
 		case GLUT_KEY_UP: g_buttonUpPressed = false; break;
 		case GLUT_KEY_DOWN: g_buttonDownPressed = false; break;
@@ -1641,8 +3934,8 @@ void specialButtonReleased(int key, int x, int y) {
 }
 
 // joystick
-void joystick(unsigned int button, int x, int y, int z) {
-	#define IGNORECENTERDELTA 15 // My theC64-joystick returns -7 when centered 
+#define IGNORECENTERDELTA 15 // My theC64-joystick returns -7 when centered 
+void handleJoystick(unsigned int button, int x, int y) {
 	g_joystickBackward = (y > IGNORECENTERDELTA);
 	g_joystickForward = (y < -IGNORECENTERDELTA);
 	g_joystickRight = (x > IGNORECENTERDELTA);
@@ -1654,7 +3947,7 @@ void joystick(unsigned int button, int x, int y, int z) {
 
 
 // mouse wheel to move viewer	
-void mouseWheel(int button, int dir, int x, int y) {
+void handleMouseWheel(int dir) {
 
 	g_mouseBackward = (dir < 0);
 		
@@ -1665,7 +3958,7 @@ void mouseWheel(int button, int dir, int x, int y) {
 
 
 // mouse
-void mouse(int button, int state, int x, int y) {
+void handleMouse(int button, int state) {
 	g_mouseLeft = ((button == GLUT_LEFT_BUTTON) && (state == GLUT_DOWN ));
 	g_mouseRight = ((button == GLUT_RIGHT_BUTTON) && (state == GLUT_DOWN ));
 	g_mouseForward = ((button == GLUT_MIDDLE_BUTTON) && (state == GLUT_DOWN ));
@@ -1673,125 +3966,1010 @@ void mouse(int button, int state, int x, int y) {
 	if ((g_state == STATE_START) && (g_mouseForward || g_mouseRight || g_mouseLeft )) changeStateToRunning();
 }
 
-// Check for currently pressed buttons, joystick and mouse
-void checkInput()
+// Append event to input ring (false = ring full)
+bool pushInputEvent(const InputEvent &event) {
+	unsigned int tail = g_inputRingTail.load(std::memory_order_relaxed);
+
+	if (tail - g_inputRingHead.load(std::memory_order_acquire) == INPUTRINGSIZE) return false;
+	g_inputRing[tail & (INPUTRINGSIZE-1)] = event;
+	g_inputRingTail.store(tail+1,std::memory_order_release);
+	return true;
+}
+
+// Take oldest event from input ring (false = ring empty)
+bool popInputEvent(InputEvent &event) {
+	unsigned int head = g_inputRingHead.load(std::memory_order_relaxed);
+
+	if (head == g_inputRingTail.load(std::memory_order_acquire)) return false;
+	event = g_inputRing[head & (INPUTRINGSIZE-1)];
+	g_inputRingHead.store(head+1,std::memory_order_release);
+	return true;
+}
+
+// Replay of recorded input events in progress?
+bool isReplaying() {
+	return g_replayPosition < g_replayEvents.size();
+}
+
+// Queue input from a GLUT callback for the next simulation tick (live input is ignored while replaying, except for quit)
+void queueInputEvent(int type, int code, int x, int y) {
+	InputEvent event = { g_simulationTick, type, code, x, y };
+
+	if (isReplaying() && !((type == INPUTKEY) && ((code == 'q') || (code == 'Q') || (code == 27)))) return;
+	pushInputEvent(event);
+	requestRedraw();
+}
+
+// GLUT callbacks only queue the input
+void keyboard(unsigned char key, int x, int y) {
+	queueInputEvent(INPUTKEY,key,0,0);
+}
+
+void specialButtonPressed(int key, int x, int y) {
+	queueInputEvent(INPUTSPECIALDOWN,key,0,0);
+}
+
+void specialButtonReleased(int key, int x, int y) {
+	queueInputEvent(INPUTSPECIALUP,key,0,0);
+}
+
+void joystick(unsigned int button, int x, int y, int z) {
+	static unsigned int lastButton = 0;
+	static int lastDirections = 0;
+	int directions = (x < -IGNORECENTERDELTA) | (x > IGNORECENTERDELTA) << 1 | (y < -IGNORECENTERDELTA) << 2 | (y > IGNORECENTERDELTA) << 3;
+
+	// joystick is polled, so queue only changes
+	if ((button == lastButton) && (directions == lastDirections)) return;
+	lastButton = button;
+	lastDirections = directions;
+	queueInputEvent(INPUTJOYSTICK,button,x,y);
+}
+
+void mouseWheel(int button, int dir, int x, int y) {
+	queueInputEvent(INPUTWHEEL,0,dir,0);
+}
+
+void mouse(int button, int state, int x, int y) {
+	queueInputEvent(INPUTMOUSE,button,state,0);
+}
+
+// Handle input event in current simulation tick (and record it)
+void handleInputEvent(const InputEvent &event) {
+	if (g_recordFile != NULL) {
+		fprintf(g_recordFile,"%d %d %d %d %d\n",g_simulationTick,event.type,event.code,event.x,event.y);
+		fflush(g_recordFile); // keep the stream if the program dies
+	}
+	switch (event.type) {
+		case INPUTKEY: handleKey(event.code); break;
+		case INPUTSPECIALDOWN: handleSpecialButtonPressed(event.code); break;
+		case INPUTSPECIALUP: handleSpecialButtonReleased(event.code); break;
+		case INPUTJOYSTICK: handleJoystick(event.code,event.x,event.y); break;
+		case INPUTMOUSE: handleMouse(event.code,event.x); break;
+		case INPUTWHEEL: handleMouseWheel(event.x); break;
+	}
+}
+
+// Move and rotate viewer by pressed buttons, joystick and mouse, check game state (one simulation tick)
+void simulateTick()
 {
 	float newX;
 	float newY;
-	static GLint lastKeyCheckTime = 0;
-			
-	if (glutGet(GLUT_ELAPSED_TIME) - lastKeyCheckTime > 20) { // check only every 20ms to reduce speed
-
-		if (g_buttonUpPressed || g_joystickForward || g_mouseForward) {
-			newX = g_viewerX + cos(M_PI*g_viewerAngle/180) * STEPSIZE;
-			newY = g_viewerY + sin(M_PI*g_viewerAngle/180) * STEPSIZE;
-
-			if (!ISGRIDINMAP(newX,newY) || ISGRIDFILLED(newX,newY)) return;
-			g_viewerX = newX;
-			g_viewerY = newY;
-		};
-		if (g_buttonDownPressed || g_joystickBackward || g_mouseBackward) {
-			newX = g_viewerX - cos(M_PI*g_viewerAngle/180) * STEPSIZE;
-			newY = g_viewerY - sin(M_PI*g_viewerAngle/180) * STEPSIZE;
-
-			if (!ISGRIDINMAP(newX,newY) || ISGRIDFILLED(newX,newY)) return;
-			g_viewerX = newX;
-			g_viewerY = newY;
-			g_mouseBackward = false;
-		};
-		if (g_buttonLeftPressed || g_joystickLeft || g_mouseLeft){
-			g_viewerAngle=(360+(int)g_viewerAngle-1)%360;
-			preparePositionDataForDDA();
+
+	// Finish state timeout?
+	if ((g_state == STATE_FINISHED) && (g_simulationTime - g_stateStartTime > DISPLAYTEXTFINISHDURATIONLENGTH*1000)) changeStateToStart();	
+
+	// Autorotate in start state
+	if (g_state == STATE_START) { 
+		g_viewerAngle += AUTOROTATESTEP;
+		if (g_viewerAngle > 360) g_viewerAngle-=360;
+		preparePositionDataForDDA();
+	}
+
+	if (g_buttonUpPressed || g_joystickForward || g_mouseForward) {
+		newX = g_viewerX + cos(M_PI*g_viewerAngle/180) * STEPSIZE;
+		newY = g_viewerY + sin(M_PI*g_viewerAngle/180) * STEPSIZE;
+
+		if (!ISGRIDINMAP(newX,newY) || ISGRIDFILLED(newX,newY)) return;
+		g_viewerX = newX;
+		g_viewerY = newY;
+	};
+	if (g_buttonDownPressed || g_joystickBackward || g_mouseBackward) {
+		newX = g_viewerX - cos(M_PI*g_viewerAngle/180) * STEPSIZE;
+		newY = g_viewerY - sin(M_PI*g_viewerAngle/180) * STEPSIZE;
+
+		if (!ISGRIDINMAP(newX,newY) || ISGRIDFILLED(newX,newY)) return;
+		g_viewerX = newX;
+		g_viewerY = newY;
+		g_mouseBackward = false;
+	};
+	if (g_buttonLeftPressed || g_joystickLeft || g_mouseLeft){
+		g_viewerAngle=(360+(int)g_viewerAngle-1)%360;
+		preparePositionDataForDDA();
+	}
+	if (g_buttonRightPressed || g_joystickRight || g_mouseRight) {
+		g_viewerAngle = (360+(int)g_viewerAngle+1)%360;
+		preparePositionDataForDDA();
+	}
+
+	collectSprites(); // in the tick, so opened walls depend only on the input events
+
+	// Finish reached?
+	if (g_state != STATE_FINISHED && ((int) g_viewerX == g_finishX) && ((int) g_viewerY == g_finishY)) changeStateToFinished();
+}
+
+// Run all simulation ticks until now: feed replayed events, handle queued input events, move viewer
+void checkInput()
+{
+	InputEvent event;
+
+	while (g_simulationTick*SIMULATIONTICK <= getElapsedTime()) {
+		g_simulationTime = g_simulationTick*SIMULATIONTICK;
+		while (isReplaying() && (g_replayEvents[g_replayPosition].tick <= g_simulationTick)) {
+			if (pushInputEvent(g_replayEvents[g_replayPosition])) g_replayPosition++;
+			else if (popInputEvent(event)) handleInputEvent(event); // ring full
 		}
-		if (g_buttonRightPressed || g_joystickRight || g_mouseRight) {
-			g_viewerAngle = (360+(int)g_viewerAngle+1)%360;
-			preparePositionDataForDDA();
+		while (popInputEvent(event)) handleInputEvent(event);
+		simulateTick();
+		g_simulationTick++;
+	}
+
+	// frame for next tick, if it changes something without active input
+	if ((g_state == STATE_START) || (g_inputRingHead.load() != g_inputRingTail.load())) requestImageChange(g_simulationTick*SIMULATIONTICK);
+	if (isReplaying()) requestImageChange(g_replayEvents[g_replayPosition].tick*SIMULATIONTICK);
+}
+
+// Open file for recording input events and write header
+bool openRecordFile() {
+	g_recordFile = fopen(g_recordFileName,"w");
+	if (g_recordFile == NULL) return false;
+	fprintf(g_recordFile,"F3DINPUT 1\n# tick type code x y\n");
+	return true;
+}
+
+// Load recorded input events for replay
+bool loadReplayFile() {
+	InputEvent event;
+	int version;
+	FILE *file = fopen(g_replayFileName,"r");
+
+	if (file == NULL) return false;
+	bool valid = (fscanf(file,"F3DINPUT %d # tick type code x y",&version) == 1) && (version == 1);
+	while (valid && (fscanf(file,"%d %d %d %d %d",&event.tick,&event.type,&event.code,&event.x,&event.y) == 5)) g_replayEvents.push_back(event);
+	valid = valid && feof(file);
+	fclose(file);
+	return valid;
+}
+
+// Cast wall rays of DDA raycasters before the background and find the background rows hidden by walls
+void castWallRays() {
+	g_minWallCover = 0;
+	g_maxWallCover = 0;
+	if (g_engine == ENGINEOLD) return; // old raycaster casts while drawing
+
+	void (*castColumns)(int, int) = (g_engine == ENGINEFIXED) ? castWallRaysFixedColumns : castWallRaysDDAColumns;
+	if (g_useFrameBuffer) parallelFor(g_viewPort3dWidth,castColumns); // columns in bands on all threads
+	else castColumns(0,g_viewPort3dWidth);
+
+	g_minWallCover = INT_MAX;
+	for (int x=0;x<g_viewPort3dWidth;x++) {
+		g_minWallCover = std::min(g_minWallCover,g_wallCover[x]);
+		g_maxWallCover = std::max(g_maxWallCover,g_wallCover[x]);
+	}
+}
+
+// View and settings which change the whole 3d view
+void getFrameKey(FrameKey &key) {
+	key.viewerX = g_viewerX;
+	key.viewerY = g_viewerY;
+	key.viewerAngle = g_viewerAngle;
+	key.width = g_viewPort3dWidth;
+	key.height = g_viewPort3dHeight;
+	key.pixelSize = g_pixelSize;
+	key.engine = g_engine;
+	key.showTextures = g_showTextures;
+	key.showBackgroundTexture = g_showBackgroundTexture;
+	key.showBackground = g_showBackground;
+	key.useMipmaps = g_useMipmaps;
+	key.useFrameBuffer = g_useFrameBuffer;
+	key.sceneChanges = g_sceneChanges;
+}
+
+// Can columns of the last frame be reused for the current frame?
+bool canReuseFrame(const FrameKey &key) {
+	const FrameKey &last = g_lastFrameKey;
+
+	if (!g_reuseFrames || !g_useFrameBuffer || (g_engine == ENGINEOLD) || !g_lastFrameValid) return false; // old raycaster draws walls and background together
+	if ((key.viewerX != last.viewerX) || (key.viewerY != last.viewerY) || (key.viewerAngle != last.viewerAngle) ||
+		(key.width != last.width) || (key.height != last.height) || (key.pixelSize != last.pixelSize) || (key.engine != last.engine) ||
+		(key.showTextures != last.showTextures) || (key.showBackgroundTexture != last.showBackgroundTexture) || (key.showBackground != last.showBackground) ||
+		(key.useMipmaps != last.useMipmaps) || (key.useFrameBuffer != last.useFrameBuffer) || (key.sceneChanges != last.sceneChanges)) return false;
+	for (int i=0;i<g_textureCount;i++) { // special texels switching between transparent and colored change the drawn pixels
+		if ((g_animatedTexels[i] == 0) != (g_lastAnimatedTexels[i] == 0)) return false;
+	}
+	return true;
+}
+
+// Find columns of last frame which show sky (a roof pixel without wall in front maps to an empty roof cell, like in the background kernels)
+void findSkyColumns() {
+	BackgroundRow row;
+
+	memset(g_skyColumns,0,g_viewPort3dWidth);
+	for (int viewPortY = g_minWallCover;viewPortY < g_viewPort3dHalfHeight;viewPortY++) {
+		prepareBackgroundRow(viewPortY,row);
+		for (int viewPortX = 0;viewPortX < g_viewPort3dWidth;viewPortX++) {
+			if (g_skyColumns[viewPortX] || (g_wallCover[viewPortX] > viewPortY)) continue;
+			int cellX = (row.floorX + viewPortX*row.stepX) >> 16;
+			int cellY = (row.floorY + viewPortX*row.stepY) >> 16;
+			if (((unsigned int) cellX >= (unsigned int) g_mapWidth) || ((unsigned int) cellY >= (unsigned int) g_mapHeight) ||
+				(MAPCELL(g_roofMap,cellX,cellY) == 0)) g_skyColumns[viewPortX] = 1;
 		}
-		lastKeyCheckTime = glutGet(GLUT_ELAPSED_TIME);
 	}
+	g_skyColumnsValid = true;
+}
+
+// Call function for runs of columns rendered in this frame within [beginX;endX[
+void forChangedColumns(int beginX, int endX, void (*function)(int,int)) {
+	int x = beginX;
+	while (x < endX) {
+		while ((x < endX) && !g_changedColumns[x]) x++;
+		int runBeginX = x;
+		while ((x < endX) && g_changedColumns[x]) x++;
+		if (x > runBeginX) function(runBeginX,x);
+	}
+}
+
+// Draw walls of changed columns [beginX;endX[ with the rays of the last complete frame
+void drawChangedWallColumns(int beginX, int endX) {
+	forChangedColumns(beginX,endX,(g_engine == ENGINEFIXED) ? drawRaycastFixedColumns : drawRaycastDDAColumns);
+}
+
+// Draw sprites of changed columns [beginX;endX[ with the projections of the last complete frame
+void drawChangedSpriteColumns(int beginX, int endX) {
+	forChangedColumns(beginX,endX,drawSpriteColumns);
+}
+
+// Render only the columns of the last frame which changed by sky rotation or animated texels
+void drawChangedColumns() {
+	bool skyChanged = false, animatedChanged = false, animatedVisible = false;
+
+	if (g_showBackground) {
+		prepareSkyOffsets();
+		skyChanged = g_showTextures && (g_textureSkyGroundOffsetAutoRotate != g_lastSkyOffset); // sky without textures is plain blue
+	}
+	for (int i=0;i<g_textureCount;i++) {
+		if (g_animatedTexels[i] != g_lastAnimatedTexels[i]) animatedChanged = true;
+	}
+	if (skyChanged && !g_skyColumnsValid) findSkyColumns();
+
+	g_changedBeginX = g_viewPort3dWidth;
+	g_changedEndX = 0;
+	for (int x=0;x<g_viewPort3dWidth;x++) {
+		if (g_animatedColumns[x]) animatedVisible = true;
+		g_changedColumns[x] = (skyChanged && g_skyColumns[x]) || (animatedChanged && g_animatedColumns[x]);
+		if (!g_changedColumns[x]) continue;
+		g_changedBeginX = std::min(g_changedBeginX,x);
+		g_changedEndX = x+1;
+	}
+	if (animatedVisible && !g_animatedTexelsDrawn.load(std::memory_order_relaxed)) g_animatedTexelsDrawn.store(true,std::memory_order_relaxed); // keep animation running
+	g_lastSkyOffset = g_textureSkyGroundOffsetAutoRotate;
+	g_lastAnimatedTexels = g_animatedTexels;
+	if (g_changedBeginX >= g_changedEndX) return; // nothing changed
+
+	if (g_showBackground) parallelFor(g_viewPort3dHalfHeight,drawBackgroundRowsFixed);
+	endStage(STAGEBACKGROUND);
+	parallelFor(g_viewPort3dWidth,drawChangedWallColumns);
+	endStage(STAGEWALLS);
+	parallelFor(g_viewPort3dWidth,drawChangedSpriteColumns);
+	endStage(STAGESPRITES);
+}
+
+// Draw 3d view (sky, ground, floor, roof, walls and sprites)
+void drawScene() {
+	FrameKey key;
+
+	beginStage();
+	prepareAnimatedTexels();
+	getFrameKey(key);
+	g_frameReused = canReuseFrame(key);
+	if (g_frameReused) {
+		if (!g_fullScreenMode) drawFieldOfView();
+		drawChangedColumns();
+		return;
+	}
+	g_lastFrameKey = key;
+	g_lastFrameValid = true;
+	g_lastAnimatedTexels = g_animatedTexels;
+	g_skyColumnsValid = false;
+	memset(g_changedColumns,1,g_viewPort3dWidth);
+	g_changedBeginX = 0;
+	g_changedEndX = g_viewPort3dWidth;
+
+	if (g_useFrameBuffer) fillFrameBufferRows(0,g_viewPort3dHeight,RGBA(BACKGROUNDGRAY*255+0.5f,BACKGROUNDGRAY*255+0.5f,BACKGROUNDGRAY*255+0.5f));
+	endStage(STAGEBACKGROUND);
+	castWallRays();
+	endStage(STAGEWALLS);
+
+	drawBackground();
+	g_lastSkyOffset = g_textureSkyGroundOffsetAutoRotate;
+	endStage(STAGEBACKGROUND);
+
+ 	switch (g_engine) {
+ 		case ENGINEOLD: drawRaycast(); break;
+ 		case ENGINEFIXED: drawRaycastFixed(); break;
+ 		default: drawRaycastDDA();
+ 	}
+	endStage(STAGEWALLS);
+	drawSprites();
+	endStage(STAGESPRITES);
 }
 
 // Display loop
 void display()
 {   
 	static GLint framesStartTime=0;
-	static GLint lastAutorotateTime = 0;
 	static int framesCounter = 0;
 	#define MAXMESSAGELENGTH 80
 	char strData[MAXMESSAGELENGTH];
+	std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
+	g_lastFrameTime = getElapsedTime();
+	if (g_targetFps > 0) { // next frame one interval after the last planned one, so timer rounding to ms does not add up
+		double frameInterval = 1000.0/g_targetFps;
+		if ((g_lastFrameTime < g_nextFrameTime) || (g_lastFrameTime - g_nextFrameTime >= frameInterval+1)) g_nextFrameTime = g_lastFrameTime; // window expose, first frame, idle mode or too slow (1 ms timer resolution)
+		g_nextFrameTime += frameInterval;
+	}
+	g_nextImageChangeTime = INT_MAX;
+	beginFrameTiming();
+	g_animatedTexelsDrawn.store(false,std::memory_order_relaxed);
+
+	// input, viewer movement and game state up to now
+	checkInput();
+
+	// reload texture pack after changes of the file
+	if (g_watchTexturePack) {
+		if (g_lastFrameTime >= g_nextTexturePackCheckTime) {
+			checkTexturePackChange();
+			g_nextTexturePackCheckTime = g_lastFrameTime + TEXTUREPACKCHECKINTERVAL;
+		}
+		requestImageChange(g_nextTexturePackCheckTime); // wake up from idle mode for next check
+	}
 
 	// Pixels round or quad
 	if (g_roundPixels) glEnable( GL_POINT_SMOOTH ); else glDisable( GL_POINT_SMOOTH ); 
-	
-	// Autorotate in start state
-	if ((g_state == STATE_START) && (glutGet(GLUT_ELAPSED_TIME) - lastAutorotateTime > 25)) { 
-		g_viewerAngle += 0.1;
-		if (g_viewerAngle > 360) g_viewerAngle-=360;
-		preparePositionDataForDDA();
-		lastAutorotateTime = glutGet(GLUT_ELAPSED_TIME);
-	}
 
 	// calculate fps
-	framesCounter++;
- 	if (glutGet(GLUT_ELAPSED_TIME)-framesStartTime > 1000) { // once per seconde		
- 		g_fps = 1000*framesCounter/(glutGet(GLUT_ELAPSED_TIME)-framesStartTime);
- 		framesStartTime = glutGet(GLUT_ELAPSED_TIME);
+ 	if (getElapsedTime()-framesStartTime > 1000) { // once per seconde		
+ 		g_fps = 1000*framesCounter/(getElapsedTime()-framesStartTime);
+ 		framesStartTime = getElapsedTime();
  		framesCounter = 0;
  		
- 		snprintf(strData,MAXMESSAGELENGTH,"Falkenstein3D %dx%dx%d X %f Y %f A %.2f S %d",g_viewPort3dWidth,g_viewPort3dHeight,g_pixelSize,g_viewerX,g_viewerY,g_viewerAngle,g_state);
+ 		snprintf(strData,MAXMESSAGELENGTH,"Falkenstein3D %dx%dx%.3g X %f Y %f A %.2f S %d",g_viewPort3dWidth,g_viewPort3dHeight,g_pixelSize,g_viewerX,g_viewerY,g_viewerAngle,g_state);
  		glutSetWindowTitle(strData);
-				
-		if (g_autoPixelSize && (g_fps!=0)) { //automatic pixel size dependent on framerate (prevents low fps)
-			if ((g_fps < 30) && (g_pixelSize<16)) { 
-				g_pixelSize++;
-				recalcDisplayProperties();
-			}
-			if ((g_fps > 100) && (g_pixelSize>1)) {
-				g_pixelSize--;
-				recalcDisplayProperties();
-			}		 	
-		}
 	}
-	
-	// Finish state timeout?
-	if ((g_state == STATE_FINISHED) && (glutGet(GLUT_ELAPSED_TIME) - g_stateStartTime > DISPLAYTEXTFINISHDURATIONLENGTH*1000)) changeStateToStart();	
-	// Finish reached?
-	if (g_state != STATE_FINISHED && ((int) g_viewerX == FINISHX) && ((int) g_viewerY == FINISHY)) changeStateToFinished();
+	framesCounter++;
 	
 	// clear buffer and redraw
  	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); 
+	beginStage();
  	if (!g_fullScreenMode) drawMap();
+	endStage(STAGEMAP);
 
-	drawBackground();
+	drawScene();
 
- 	if (!g_oldStyle) drawRaycastDDA(); else drawRaycast();
-	drawSprites();
+	if (g_useFrameBuffer) presentFrameBuffer();
+	endStage(STAGEPRESENT);
 	if (!g_fullScreenMode) drawViewer();
+	endStage(STAGEMAP);
 	drawInfos();		
 
 	drawMessage();
+	drawTimings();
+	endStage(STAGEHUD);
 	
 	if (g_fullScreenMode) glutSetCursor(GLUT_CURSOR_NONE); else glutSetCursor(GLUT_CURSOR_INHERIT);
 
+	if (g_animatedTexelsDrawn.load(std::memory_order_relaxed)) requestImageChange((getElapsedTime()/ANIMATEDTEXELINTERVAL+1)*ANIMATEDTEXELINTERVAL);
+	// automatic pixel size dependent on frame time (without waiting for next frame, prevents low fps)
+	if (g_autoPixelSize && !g_frameReused) updatePixelSize(std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-frameStart).count());
+
+	beginStage();
  	glutSwapBuffers();  
+	endStage(STAGESWAP);
+	endFrameTiming(std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-frameStart).count());
 
-	checkInput();
+	// next frame: at once (only limited by frame rate cap) while the viewer moves, else when the image gets outdated
+	if (!g_idleThrottling || isInputActive()) scheduleFrame(getElapsedTime());
+	else scheduleFrame(std::min(g_nextImageChangeTime,getElapsedTime()+IDLEFRAMEINTERVAL));
+}
+
+// Show command line options
+void usage() {
+	printf("Usage: Falkenstein3D [options]\n");
+	printf("  --headless            render frames without window and OpenGL and report timing\n");
+	printf("  --frames N            frames to render in headless mode (default %d, more until a replay has finished)\n",g_headlessFrames);
+	printf("  --width N             3d view width in headless mode (default %d)\n",g_headlessWidth);
+	printf("  --height N            3d view height in headless mode (default %d)\n",g_headlessHeight);
+	printf("  --pixelsize N         pixel size 1-16, fractional with CPU framebuffer (disables automatic pixel size)\n");
+	printf("  --budget MS           frame time for automatic pixel size (default %g ms)\n",g_frameTimeBudget);
+	printf("  --engine dda|old|fixed raycaster engine\n");
+	printf("  --textures on|off     all textures\n");
+	printf("  --floortextures on|off textures for floor and roof\n");
+	printf("  --background on|off   floor, roof, sky and ground\n");
+	printf("  --framebuffer on|off  CPU framebuffer (headless mode always uses it)\n");
+	printf("  --threads N           threads for rendering into CPU framebuffer (default 0 = one per cpu core)\n");
+	printf("  --simd auto|avx2|sse2|off  packet ray traversal for DDA raycaster (default auto by cpu)\n");
+	printf("  --mipmaps on|off      smaller textures for distant walls, floor and roof\n");
+	printf("  --framereuse on|off   render only changed columns while the view does not change (default on, off in headless mode)\n");
+	printf("  --fps N               frame rate cap, exact on average also for rates like 144 or above 1000 (default 0 = no cap)\n");
+	printf("  --vsync on|off        wait for vertical retrace on buffer swap (default off)\n");
+	printf("  --idle on|off         redraw only when the image changes while there is no input (default on)\n");
+	printf("  --timingcsv FILE      write times of render stages of every frame to CSV file\n");
+	printf("  --record FILE         write input events to file\n");
+	printf("  --replay FILE         play back input events from file (start with the same level and start options)\n");
+	printf("  --benchmark FILE      render camera paths with all engines and settings without window, write frame times as JSON\n");
+	printf("  --baseline FILE       compare benchmark with earlier JSON file (exit code 1 on regressions)\n");
+	printf("  --tolerance PCT       benchmark slowdown against baseline which counts as regression (default %g%%)\n",g_benchmarkTolerance);
+	printf("  --reference DIR       render fixed poses with frozen clock without window, write reference images into existing directory\n");
+	printf("  --verify DIR          render the same poses and compare with reference images (exit code 1 on differences)\n");
+	printf("  --pixeltolerance N    maximal difference per color channel when comparing with reference images (default %d)\n",g_pixelTolerance);
+	printf("  --map FILE            load level from binary map file (default built-in level)\n");
+	printf("  --savemap FILE        write level as binary map file and exit\n");
+	printf("  --texturepack FILE    load textures from texture pack file (default built-in textures)\n");
+	printf("  --savetextures FILE   write built-in textures as texture pack file and exit\n");
+	printf("  --watchtextures on|off reload texture pack when the file changes (default off)\n");
+	printf("  --x X --y Y --angle A viewer start position and angle (default from level)\n");
+	printf("  --help                show this help\n");
+}
+
+// Parse on/off value of command line option
+bool argOnOff(const char *value, bool &result) {
+	if (strcmp(value,"on") == 0) { result = true; return true; }
+	if (strcmp(value,"off") == 0) { result = false; return true; }
+	return false;
 }
 
-// Parse program arguments
+// Parse program arguments (options without leading "--" are left for glut)
 int args(int argc, char **argv)
 {
     GLint i;
+    const char *value;
 
     for (i = 1; i < argc; i++) {
-    	// currently not used
-	}	
+    	if (strncmp(argv[i],"--",2) != 0) continue;
+
+    	if (strcmp(argv[i],"--help") == 0) {
+    		usage();
+    		exit(0);
+		}
+    	if (strcmp(argv[i],"--headless") == 0) {
+    		g_headless = true;
+    		continue;
+		}
+
+		// all other options need a value
+		if (i+1 >= argc) {
+			fprintf(stderr,"Missing value for option %s\n",argv[i]);
+			return 1;
+		}
+		value = argv[++i];
+
+		if (strcmp(argv[i-1],"--frames") == 0) {
+			g_headlessFrames = atoi(value);
+			if (g_headlessFrames < 1) break;
+		} else if (strcmp(argv[i-1],"--width") == 0) {
+			g_headlessWidth = atoi(value);
+			if ((g_headlessWidth < 1) || (g_headlessWidth > MAXWIDTH)) break;
+		} else if (strcmp(argv[i-1],"--height") == 0) {
+			g_headlessHeight = atoi(value);
+			if ((g_headlessHeight < 2) || (g_headlessHeight > MAXHEIGHT)) break;
+		} else if (strcmp(argv[i-1],"--pixelsize") == 0) {
+			g_pixelSize = atof(value);
+			g_autoPixelSize = false;
+			if (!(g_pixelSize >= 1) || (g_pixelSize > MAXPIXELSIZE)) break;
+		} else if (strcmp(argv[i-1],"--budget") == 0) {
+			g_frameTimeBudget = atof(value);
+			if (!(g_frameTimeBudget > 0)) break;
+		} else if (strcmp(argv[i-1],"--engine") == 0) {
+			for (g_engine=0;(g_engine < ENGINECOUNT) && (strcmp(value,g_engineNames[g_engine]) != 0);g_engine++);
+			if (g_engine == ENGINECOUNT) break;
+		} else if (strcmp(argv[i-1],"--textures") == 0) {
+			if (!argOnOff(value,g_showTextures)) break;
+		} else if (strcmp(argv[i-1],"--floortextures") == 0) {
+			if (!argOnOff(value,g_showBackgroundTexture)) break;
+		} else if (strcmp(argv[i-1],"--background") == 0) {
+			if (!argOnOff(value,g_showBackground)) break;
+		} else if (strcmp(argv[i-1],"--framebuffer") == 0) {
+			if (!argOnOff(value,g_useFrameBuffer)) break;
+		} else if (strcmp(argv[i-1],"--threads") == 0) {
+			g_threadCount = atoi(value);
+			if (g_threadCount < 0) break;
+		} else if (strcmp(argv[i-1],"--mipmaps") == 0) {
+			if (!argOnOff(value,g_useMipmaps)) break;
+		} else if (strcmp(argv[i-1],"--framereuse") == 0) {
+			if (!argOnOff(value,g_reuseFrames)) break;
+			g_reuseFramesOption = true;
+		} else if (strcmp(argv[i-1],"--simd") == 0) {
+			if (strcmp(value,"auto") == 0) g_simdMode = SIMDAUTO;
+			else if (strcmp(value,"off") == 0) g_simdMode = SIMDOFF;
+			else if (strcmp(value,"sse2") == 0) g_simdMode = SIMDSSE2;
+			else if (strcmp(value,"avx2") == 0) g_simdMode = SIMDAVX2;
+			else break;
+		} else if (strcmp(argv[i-1],"--fps") == 0) {
+			g_targetFps = atoi(value);
+			if (g_targetFps < 0) break;
+		} else if (strcmp(argv[i-1],"--vsync") == 0) {
+			if (!argOnOff(value,g_vsync)) break;
+		} else if (strcmp(argv[i-1],"--idle") == 0) {
+			if (!argOnOff(value,g_idleThrottling)) break;
+		} else if (strcmp(argv[i-1],"--timingcsv") == 0) {
+			g_timingFileName = value;
+		} else if (strcmp(argv[i-1],"--record") == 0) {
+			g_recordFileName = value;
+		} else if (strcmp(argv[i-1],"--replay") == 0) {
+			g_replayFileName = value;
+		} else if (strcmp(argv[i-1],"--benchmark") == 0) {
+			g_benchmarkFileName = value;
+			g_headless = true;
+		} else if (strcmp(argv[i-1],"--baseline") == 0) {
+			g_baselineFileName = value;
+		} else if (strcmp(argv[i-1],"--tolerance") == 0) {
+			g_benchmarkTolerance = atof(value);
+			if (!(g_benchmarkTolerance >= 0)) break;
+		} else if (strcmp(argv[i-1],"--reference") == 0) {
+			g_referenceDirectory = value;
+			g_headless = true;
+		} else if (strcmp(argv[i-1],"--verify") == 0) {
+			g_verifyDirectory = value;
+			g_headless = true;
+		} else if (strcmp(argv[i-1],"--pixeltolerance") == 0) {
+			g_pixelTolerance = atoi(value);
+			if (g_pixelTolerance < 0) break;
+		} else if (strcmp(argv[i-1],"--map") == 0) {
+			g_mapFileName = value;
+		} else if (strcmp(argv[i-1],"--savemap") == 0) {
+			g_saveMapFileName = value;
+		} else if (strcmp(argv[i-1],"--texturepack") == 0) {
+			g_texturePackFileName = value;
+		} else if (strcmp(argv[i-1],"--savetextures") == 0) {
+			g_saveTexturesFileName = value;
+		} else if (strcmp(argv[i-1],"--watchtextures") == 0) {
+			if (!argOnOff(value,g_watchTexturePack)) break;
+		} else if (strcmp(argv[i-1],"--x") == 0) {
+			g_argViewerX = atof(value);
+		} else if (strcmp(argv[i-1],"--y") == 0) {
+			g_argViewerY = atof(value);
+		} else if (strcmp(argv[i-1],"--angle") == 0) {
+			g_argViewerAngle = atof(value);
+		} else {
+			fprintf(stderr,"Unknown option %s\n",argv[i-1]);
+			return 1;
+		}
+	}
+	if (i < argc) { // loop aborted by invalid value
+		fprintf(stderr,"Invalid value %s for option %s\n",argv[i],argv[i-1]);
+		return 1;
+	}
     return 0;
 }
 
+// Render frames without window and OpenGL and report the timing
+int runHeadless() {
+	double frameTime, minFrameTime = HUGEBIGNUMBER, maxFrameTime = 0, totalFrameTime = 0;
+	double minTime, avgTime, p99Time;
+	int frames;
+
+	g_useFrameBuffer = true; // no OpenGL available
+	if (!g_reuseFramesOption) g_reuseFrames = false; // timing of complete frames
+	g_roundPixels = false;
+	g_fullScreenMode = true; // no 2D map
+	g_viewPort3dOffsetX = 0;
+	g_viewPort3dPhysicalWidth = g_headlessWidth;
+	g_viewPort3dPhysicalHeight = g_headlessHeight;
+	recalcDisplayProperties();
+
+	changeStateToStart();
+	if (g_replayFileName == NULL) changeStateToRunning(); // a replay starts the game by its first event, like in the window
+	preparePositionDataForDDA();
+
+	for (frames=0;(frames<g_headlessFrames) || isReplaying();frames++) { // replay is always played to the end
+		std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+		beginFrameTiming();
+		if (g_replayFileName != NULL) checkInput(); // replayed viewer path in real time
+		drawScene();
+		frameTime = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-frameStart).count();
+		endFrameTiming(frameTime);
+		totalFrameTime += frameTime;
+		if (frameTime < minFrameTime) minFrameTime = frameTime;
+		if (frameTime > maxFrameTime) maxFrameTime = frameTime;
+	}
+
+	printf("Falkenstein3D headless %dx%d (3d view %dx%d), pixel size %g, engine %s, textures %s, floor/roof textures %s, background %s, mipmaps %s, frame reuse %s, threads %d, kernels %s\n",
+		g_headlessWidth,g_headlessHeight,g_viewPort3dWidth,g_viewPort3dHeight,g_pixelSize,g_engineNames[g_engine],
+		g_showTextures?"on":"off",g_showBackgroundTexture?"on":"off",g_showBackground?"on":"off",g_useMipmaps?"on":"off",g_reuseFrames?"on":"off",g_threadCount,g_kernelName);
+	printf("%d frames in %.1f ms, avg %.3f ms/frame (%.1f fps), min %.3f ms, max %.3f ms\n",
+		frames,totalFrameTime,totalFrameTime/frames,1000*frames/totalFrameTime,minFrameTime,maxFrameTime);
+	for (int i=STAGEBACKGROUND;i<=STAGESPRITES;i++) { // stages of 3d view over the last frames
+		stageStatistics(i,minTime,avgTime,p99Time);
+		printf("  %-10s min %.3f ms, avg %.3f ms, p99 %.3f ms (last %d frames)\n",g_stageNames[i],minTime,avgTime,p99Time,std::min(g_timedFrames,TIMINGHISTORY));
+	}
+	return 0;
+}
+
+// Viewer position and angle in a benchmark frame
+struct CameraPose {
+	float x;
+	float y;
+	float angle;
+};
+
+// Frame time percentiles of one benchmark run (path, engine and settings in key)
+struct BenchmarkResult {
+	char key[BENCHMARKKEYLENGTH];
+	int frames;
+	double avg, p50, p95, p99;
+};
+
+// Add frames rotating the viewer at a position
+void addBenchmarkRotation(std::vector<CameraPose> &poses, float x, float y, float beginAngle, float endAngle) {
+	for (float angle = beginAngle; angle < endAngle; angle += BENCHMARKROTATIONSTEP) {
+		CameraPose pose = { x, y, fmodf(angle+360,360) };
+		poses.push_back(pose);
+	}
+}
+
+// Free cells between two positions?
+bool isBenchmarkLineFree(float x1, float y1, float x2, float y2) {
+	for (int i=0;i<=8;i++) {
+		float x = x1+(x2-x1)*i/8;
+		float y = y1+(y2-y1)*i/8;
+		if (!ISGRIDINMAP(x,y) || ISGRIDFILLED(x,y)) return false;
+	}
+	return true;
+}
+
+// Build camera path of benchmark for current level
+void buildBenchmarkPath(int path, std::vector<CameraPose> &poses) {
+	poses.clear();
+	switch (path) {
+		case BENCHMARKPATHSTART:
+			addBenchmarkRotation(poses,g_startViewerX,g_startViewerY,0,360);
+			break;
+		case BENCHMARKPATHFINISH:
+			addBenchmarkRotation(poses,g_finishX+0.5f,g_finishY+0.5f,0,360);
+			break;
+		case BENCHMARKPATHSPRITES:
+			for (size_t i=0;i<g_sprites.size();i++) {
+				for (int direction=0;direction<360;direction+=45) { // first free spot 1.5 cells away, outside the cell of the sprite (no collecting)
+					float x = g_sprites[i].x - cos(M_PI*direction/180)*1.5f;
+					float y = g_sprites[i].y - sin(M_PI*direction/180)*1.5f;
+					if (((int) x == (int) g_sprites[i].x) && ((int) y == (int) g_sprites[i].y)) continue;
+					if (!isBenchmarkLineFree(g_sprites[i].x,g_sprites[i].y,x,y)) continue;
+					addBenchmarkRotation(poses,x,y,direction-20,direction+20+1);
+					break;
+				}
+			}
+			break;
+		case BENCHMARKPATHWALK: {
+			float x = g_startViewerX, y = g_startViewerY;
+			float stepX = cos(M_PI*g_startViewerAngle/180)*STEPSIZE*2, stepY = sin(M_PI*g_startViewerAngle/180)*STEPSIZE*2;
+			for (int i=0;(i<BENCHMARKWALKFRAMES) && isBenchmarkLineFree(x,y,x+4*stepX,y+4*stepY);i++) { // stop a little before the wall
+				CameraPose pose = { x, y, g_startViewerAngle };
+				poses.push_back(pose);
+				x += stepX;
+				y += stepY;
+			}
+			break;
+		}
+	}
+}
+
+// Nearest rank percentile of sorted values
+double percentile(const std::vector<double> &sorted, int percent) {
+	return sorted[(sorted.size()*percent+99)/100-1];
+}
+
+// Load results of an earlier benchmark (only the JSON format written by runBenchmark)
+bool loadBenchmarkBaseline(std::vector<BenchmarkResult> &baseline) {
+	char line[512];
+	BenchmarkResult result;
+	FILE *file = fopen(g_baselineFileName,"r");
+
+	if (file == NULL) return false;
+	while (fgets(line,sizeof(line),file) != NULL) {
+		const char *begin = strstr(line,"{\"path\"");
+		const char *end = strstr(line,", \"frames\"");
+		const char *p50 = strstr(line,"\"p50\": ");
+		const char *p95 = strstr(line,"\"p95\": ");
+		if ((begin == NULL) || (end == NULL) || (p50 == NULL) || (p95 == NULL) || (end-begin-1 >= BENCHMARKKEYLENGTH)) continue;
+		memcpy(result.key,begin+1,end-begin-1);
+		result.key[end-begin-1] = '\0';
+		result.p50 = atof(p50+7);
+		result.p95 = atof(p95+7);
+		baseline.push_back(result);
+	}
+	fclose(file);
+	return !baseline.empty();
+}
+
+// Render camera paths with all engines at several resolutions, pixel sizes and settings, write frame time percentiles as JSON
+// and report regressions against a baseline (return value 1)
+int runBenchmark() {
+	// 3d view width, height and pixel size
+	const int views[][3] = { { 640, 400, 1 }, { 1280, 720, 1 }, { 1920, 1080, 1 }, { 1920, 1080, 2 } };
+	// textures, background
+	const bool qualities[][2] = { { true, true }, { false, true }, { true, false } };
+	std::vector<CameraPose> paths[BENCHMARKPATHCOUNT];
+	std::vector<std::vector<double> > runFrameTimes; // times of every frame in every pass per run
+	std::vector<double> frameTimes, passTimes;
+	std::vector<BenchmarkResult> baseline;
+	BenchmarkResult result;
+	int runs, regressions = 0;
+	FILE *file;
+
+	if ((g_baselineFileName != NULL) && !loadBenchmarkBaseline(baseline)) {
+		fprintf(stderr,"Could not read benchmark baseline %s\n",g_baselineFileName);
+		return 1;
+	}
+	file = fopen(g_benchmarkFileName,"w");
+	if (file == NULL) {
+		fprintf(stderr,"Could not write benchmark file %s\n",g_benchmarkFileName);
+		return 1;
+	}
+
+	g_useFrameBuffer = true; // no OpenGL available
+	g_reuseFrames = false; // complete frames only
+	g_roundPixels = false;
+	g_fullScreenMode = true; // no 2D map
+	g_viewPort3dOffsetX = 0;
+
+	changeStateToStart();
+	for (int path=0;path<BENCHMARKPATHCOUNT;path++) buildBenchmarkPath(path,paths[path]);
+
+	fprintf(file,"{\n  \"version\": 1,\n  \"kernels\": \"%s\",\n  \"threads\": %d,\n  \"mipmaps\": %s,\n  \"runs\": [",
+		g_kernelName,g_threadCount,g_useMipmaps?"true":"false");
+	// whole matrix in every pass, so a temporary load on the machine slows down only one pass of a run
+	for (int repeat=0;repeat<BENCHMARKREPEATS;repeat++) {
+		runs = 0;
+		for (size_t view=0;view<sizeof(views)/sizeof(views[0]);view++) {
+			g_viewPort3dPhysicalWidth = views[view][0];
+			g_viewPort3dPhysicalHeight = views[view][1];
+			g_pixelSize = views[view][2];
+			recalcDisplayProperties();
+			for (size_t quality=0;quality<sizeof(qualities)/sizeof(qualities[0]);quality++) {
+				g_showTextures = qualities[quality][0];
+				g_showBackground = qualities[quality][1];
+				for (g_engine=0;g_engine<ENGINECOUNT;g_engine++) {
+					for (int path=0;path<BENCHMARKPATHCOUNT;path++) {
+						if (paths[path].empty()) continue;
+						if (repeat == 0) runFrameTimes.push_back(std::vector<double>(paths[path].size()*BENCHMARKREPEATS));
+						std::vector<double> &times = runFrameTimes[runs++];
+
+						// fresh level (no collected sprites, no opened walls)
+						changeStateToStart();
+						changeStateToRunning();
+						for (int i=-BENCHMARKWARMUPFRAMES;i<(int) paths[path].size();i++) {
+							const CameraPose &pose = paths[path][std::max(i,0)];
+							g_viewerX = pose.x;
+							g_viewerY = pose.y;
+							g_viewerAngle = pose.angle;
+							preparePositionDataForDDA();
+							collectSprites();
+							std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+							drawScene();
+							if (i >= 0) times[i*BENCHMARKREPEATS+repeat] = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-frameStart).count();
+						}
+						if (repeat < BENCHMARKREPEATS-1) continue;
+
+						frameTimes.clear();
+						for (size_t i=0;i<paths[path].size();i++) {
+							passTimes.assign(times.begin()+i*BENCHMARKREPEATS,times.begin()+(i+1)*BENCHMARKREPEATS);
+							std::sort(passTimes.begin(),passTimes.end());
+							frameTimes.push_back(percentile(passTimes,50));
+						}
+
+						snprintf(result.key,BENCHMARKKEYLENGTH,"\"path\": \"%s\", \"engine\": \"%s\", \"width\": %d, \"height\": %d, \"pixelsize\": %g, \"textures\": %s, \"background\": %s",
+							g_benchmarkPathNames[path],g_engineNames[g_engine],views[view][0],views[view][1],g_pixelSize,g_showTextures?"true":"false",g_showBackground?"true":"false");
+						result.frames = frameTimes.size();
+						result.avg = 0;
+						for (size_t i=0;i<frameTimes.size();i++) result.avg += frameTimes[i]/frameTimes.size();
+						std::sort(frameTimes.begin(),frameTimes.end());
+						result.p50 = percentile(frameTimes,50);
+						result.p95 = percentile(frameTimes,95);
+						result.p99 = percentile(frameTimes,99);
+						fprintf(file,"%s\n    {%s, \"frames\": %d, \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f}",
+							(runs > 1)?",":"",result.key,result.frames,result.avg,result.p50,result.p95,result.p99);
+
+						printf("%-7s %-5s %4dx%-4d px %g textures %-3s background %-3s: p50 %7.3f ms, p95 %7.3f ms, p99 %7.3f ms",
+							g_benchmarkPathNames[path],g_engineNames[g_engine],views[view][0],views[view][1],g_pixelSize,
+							g_showTextures?"on":"off",g_showBackground?"on":"off",result.p50,result.p95,result.p99);
+						for (size_t i=0;i<baseline.size();i++) {
+							if (strcmp(baseline[i].key,result.key) != 0) continue;
+							bool regression = ((result.p50 > baseline[i].p50*(1+g_benchmarkTolerance/100)) && (result.p50-baseline[i].p50 > BENCHMARKMINDIFF)) ||
+								((result.p95 > baseline[i].p95*(1+g_benchmarkTolerance/100)) && (result.p95-baseline[i].p95 > BENCHMARKMINDIFF));
+							printf(", baseline p50 %+.1f%% p95 %+.1f%%%s",100*(result.p50/baseline[i].p50-1),100*(result.p95/baseline[i].p95-1),regression?" REGRESSION":"");
+							if (regression) regressions++;
+							break;
+						}
+						printf("\n");
+					}
+				}
+			}
+		}
+	}
+	fprintf(file,"\n  ]\n}\n");
+	fclose(file);
+
+	printf("%d benchmark runs written to %s",runs,g_benchmarkFileName);
+	if (g_baselineFileName != NULL) printf(", %d regressions (more than %g%% slower than %s)",regressions,g_benchmarkTolerance,g_baselineFileName);
+	printf("\n");
+	return (regressions > 0) ? 1 : 0;
+}
+
+// Write RGBA pixels as binary PPM image
+bool writePPM(const char *fileName, const std::vector<unsigned int> &pixels, int width, int height) {
+	std::vector<unsigned char> rgb(width*height*3);
+	FILE *file = fopen(fileName,"wb");
+
+	if (file == NULL) return false;
+	for (int i=0;i<width*height;i++) {
+		rgb[i*3] = pixels[i] & 255;
+		rgb[i*3+1] = (pixels[i] >> 8) & 255;
+		rgb[i*3+2] = (pixels[i] >> 16) & 255;
+	}
+	fprintf(file,"P6\n%d %d\n255\n",width,height);
+	bool written = (fwrite(&rgb[0],1,rgb.size(),file) == rgb.size());
+	return (fclose(file) == 0) && written;
+}
+
+// Read binary PPM image as RGBA pixels (only the format written by writePPM)
+bool readPPM(const char *fileName, std::vector<unsigned int> &pixels, int &width, int &height) {
+	int maxValue;
+	FILE *file = fopen(fileName,"rb");
+
+	if (file == NULL) return false;
+	if ((fscanf(file,"P6 %d %d %d",&width,&height,&maxValue) != 3) || (maxValue != 255) || (width < 1) || (height < 1) || (fgetc(file) == EOF)) {
+		fclose(file);
+		return false;
+	}
+	std::vector<unsigned char> rgb(width*height*3);
+	bool read = (fread(&rgb[0],1,rgb.size(),file) == rgb.size());
+	fclose(file);
+	pixels.resize(width*height);
+	for (int i=0;i<width*height;i++) pixels[i] = RGBA(rgb[i*3],rgb[i*3+1],rgb[i*3+2]);
+	return read;
+}
+
+// Maximal difference of the color channels of two RGBA pixels
+inline int colorDifference(unsigned int a, unsigned int b) {
+	int difference = 0;
+	for (int shift=0;shift<24;shift+=8) difference = std::max(difference,abs((int) ((a >> shift) & 255) - (int) ((b >> shift) & 255)));
+	return difference;
+}
+
+// Render poses of the benchmark camera paths with all engines and settings at a frozen clock and write them as reference images
+// or compare them with the reference images (differing images are written as .actual.ppm and .diff.ppm, return value 1)
+int runReferenceImages() {
+	const char *qualityNames[] = { "full", "notextures", "nobackground" };
+	// textures, background
+	const bool qualities[][2] = { { true, true }, { false, true }, { true, false } };
+	std::vector<CameraPose> poses;
+	std::vector<unsigned int> reference, diff;
+	char name[64], fileName[FILENAME_MAX];
+	int width, height, differingPixels, maxDifference, images = 0, failures = 0;
+	bool verify = (g_verifyDirectory != NULL);
+	const char *directory = verify ? g_verifyDirectory : g_referenceDirectory;
+
+	g_frozenTime = REFERENCECLOCK; // same sky rotation and animated texels in every image
+	g_useFrameBuffer = true; // no OpenGL available
+	g_reuseFrames = false; // complete frames only
+	g_roundPixels = false;
+	g_fullScreenMode = true; // no 2D map
+	g_viewPort3dOffsetX = 0;
+	g_viewPort3dPhysicalWidth = REFERENCEWIDTH;
+	g_viewPort3dPhysicalHeight = REFERENCEHEIGHT;
+	g_pixelSize = 1;
+	recalcDisplayProperties();
+
+	changeStateToStart();
+	for (int path=0;path<BENCHMARKPATHCOUNT;path++) {
+		buildBenchmarkPath(path,poses);
+		for (size_t pose=0;pose<poses.size();pose+=REFERENCEPOSESTEP) {
+			for (size_t quality=0;quality<sizeof(qualities)/sizeof(qualities[0]);quality++) {
+				g_showTextures = qualities[quality][0];
+				g_showBackground = qualities[quality][1];
+				for (g_engine=0;g_engine<ENGINECOUNT;g_engine++) {
+					// fresh level (no collected sprites, no opened walls)
+					changeStateToStart();
+					changeStateToRunning();
+					g_viewerX = poses[pose].x;
+					g_viewerY = poses[pose].y;
+					g_viewerAngle = poses[pose].angle;
+					preparePositionDataForDDA();
+					collectSprites();
+					drawScene();
+					images++;
+
+					snprintf(name,sizeof(name),"%s_%03d_%s_%s",g_benchmarkPathNames[path],(int) pose,g_engineNames[g_engine],qualityNames[quality]);
+					snprintf(fileName,sizeof(fileName),"%s/%s.ppm",directory,name);
+					if (!verify) {
+						if (writePPM(fileName,g_frameBuffer,g_viewPort3dWidth,g_viewPort3dHeight)) continue;
+						fprintf(stderr,"Could not write reference image %s\n",fileName);
+						return 1;
+					}
+
+					if (!readPPM(fileName,reference,width,height) || (width != g_viewPort3dWidth) || (height != g_viewPort3dHeight)) {
+						printf("%s: no reference image with %dx%d pixels\n",name,g_viewPort3dWidth,g_viewPort3dHeight);
+						failures++;
+						continue;
+					}
+					// diff image: differing pixels red, other pixels dark gray of reference
+					differingPixels = 0;
+					maxDifference = 0;
+					diff.resize(reference.size());
+					for (size_t i=0;i<reference.size();i++) {
+						int difference = colorDifference(reference[i],g_frameBuffer[i]);
+						int gray = ((reference[i] & 255) + ((reference[i] >> 8) & 255) + ((reference[i] >> 16) & 255))/9;
+						maxDifference = std::max(maxDifference,difference);
+						if (difference > g_pixelTolerance) differingPixels++;
+						diff[i] = (difference > g_pixelTolerance) ? RGBA(255,0,0) : RGBA(gray,gray,gray);
+					}
+					if (differingPixels == 0) continue;
+
+					printf("%s: %d pixels differ more than %d (max %d)\n",name,differingPixels,g_pixelTolerance,maxDifference);
+					failures++;
+					snprintf(fileName,sizeof(fileName),"%s/%s.actual.ppm",directory,name);
+					writePPM(fileName,g_frameBuffer,g_viewPort3dWidth,g_viewPort3dHeight);
+					snprintf(fileName,sizeof(fileName),"%s/%s.diff.ppm",directory,name);
+					writePPM(fileName,diff,g_viewPort3dWidth,g_viewPort3dHeight);
+				}
+			}
+		}
+	}
+
+	if (verify) printf("%d of %d images differ from reference images in %s (pixel tolerance %d)\n",failures,images,directory,g_pixelTolerance);
+	else printf("%d reference images written to %s\n",images,directory);
+	return (failures > 0) ? 1 : 0;
+}
+
 // main
 int main(int argc, char* argv[])
 { 
+	if (args(argc, argv) != 0) exit(1);
+	if (g_saveTexturesFileName != NULL) {
+		if (saveTextures(g_saveTexturesFileName)) return 0;
+		fprintf(stderr,"Could not write texture pack file %s\n",g_saveTexturesFileName);
+		return 1;
+	}
+	if (!loadTextures()) exit(1); // before level, map is checked against the number of textures
+	if (!loadLevel()) exit(1);
+	if ((g_timingFileName != NULL) && !openTimingFile()) {
+		fprintf(stderr,"Could not write timing file %s\n",g_timingFileName);
+		exit(1);
+	}
+	if ((g_recordFileName != NULL) && !openRecordFile()) {
+		fprintf(stderr,"Could not write input record file %s\n",g_recordFileName);
+		exit(1);
+	}
+	if ((g_replayFileName != NULL) && !loadReplayFile()) {
+		fprintf(stderr,"Could not read input replay file %s\n",g_replayFileName);
+		exit(1);
+	}
+	if (g_saveMapFileName != NULL) {
+		if (saveMap(g_saveMapFileName)) return 0;
+		fprintf(stderr,"Could not write map file %s\n",g_saveMapFileName);
+		return 1;
+	}
+
+	prepareLightTables();
+	prepareReciprocalTable();
+	prepareTextures();
+	startJobSystem();
+	selectKernels();
+
+	if (g_benchmarkFileName != NULL) return runBenchmark();
+	if ((g_referenceDirectory != NULL) || (g_verifyDirectory != NULL)) return runReferenceImages();
+	if (g_headless) return runHeadless();
+
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB); // double buffer and rgb mode
 	
@@ -1801,10 +4979,11 @@ int main(int argc, char* argv[])
 	g_savedWindowHeight = g_windowHeight;
 	g_savedWindowWidth = g_windowWidth;
 	
-	g_viewPort3dPhysicalWidth = g_windowWidth - GRIDSIZE*MAPWIDTH;
+	if (g_gridSize == 0) g_fullScreenMode = true; // map too large for 2d view
+	g_viewPort3dPhysicalWidth = g_windowWidth - g_gridSize*g_mapWidth;
 	g_viewPort3dPhysicalHeight = g_windowHeight;
 
-	if (g_fullScreenMode) g_viewPort3dOffsetX = 0; else g_viewPort3dOffsetX = MAPWIDTH*GRIDSIZE;	
+	if (g_fullScreenMode) g_viewPort3dOffsetX = 0; else g_viewPort3dOffsetX = g_mapWidth*g_gridSize;	
 	recalcDisplayProperties();
 	
 	preparePositionDataForDDA();
@@ -1813,14 +4992,12 @@ int main(int argc, char* argv[])
 	glutInitWindowPosition(0,0);
 	glutCreateWindow("Falkenstein3D");
 
-	if (args(argc, argv) != 0) exit(1);
-
 	if (g_fullScreenMode) glutFullScreen();
 	
 	gluOrtho2D(-0.5,g_windowWidth-0.5,g_windowHeight-0.5,-0.5); // Offset of 0.5 to show pixels on 0
 	
-	glClearColor(0.1,0.1,0.1,0); // Default background color
-	glutIdleFunc(glutPostRedisplay);
+	glClearColor(BACKGROUNDGRAY,BACKGROUNDGRAY,BACKGROUNDGRAY,0); // Default background color
+	setVSync(g_vsync);
 	glutDisplayFunc(display);
 	glutReshapeFunc(resize);
 	glutSpecialUpFunc(specialButtonReleased);
@@ -1831,6 +5008,7 @@ int main(int argc, char* argv[])
 	glutMouseWheelFunc(mouseWheel);
 	
 	changeStateToStart();
+	scheduleFrame(0);
 	
 	glutMainLoop();
 }